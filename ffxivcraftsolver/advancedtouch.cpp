@@ -341,6 +341,7 @@ void parseRecipe(const rapidjson::Document& d, recipeStats* recipe)
 	recipe->qualityFactor = getQualityFactor(recipe->rLevel);
 	recipe->progressPenalty = getProgressPenalty(recipe->rLevel);
 	recipe->qualityPenalty = getQualityPenalty(recipe->rLevel);
+	recipe->conditionsFlag = getConditionsFlag(recipe->rLevel);
 
 	if (recipe->progressFactor == 0 || recipe->qualityFactor == 0 || recipe->progressPenalty == 0 || recipe->progressPenalty == 0)
 	{
@@ -358,11 +359,18 @@ struct options
 	int stepwiseGenerations;
 	int population;
 	int maxCacheSize;
+	string cacheFile;
 
 	bool normalLock;
 	int threads;
 
 	bool useConditionals;
+	bool exactEvaluation;
+	bool adaptiveSimulations;
+	bool commonRandomNumbers;
+	samplingMethod sampling;
+	int verifyCandidates;
+	int verifySimulations;
 
 	double selectionPressure;
 };
@@ -380,10 +388,28 @@ void parseOptions(const rapidjson::Document& d, options* opts, bool solveMode, b
 	opts->stepwiseGenerations = getIntIfExists(d, "/stepwise generations");
 	opts->population = getIntIfExists(d, "/population");
 	opts->maxCacheSize = getIntIfExists(d, "/max cache size");
+	opts->cacheFile = getStringIfExists(d, "/cache file", "");
 	
 	opts->normalLock = getBoolIfExists(d, "/normal lock");
 	opts->threads = getIntIfExists(d, "/threads");
 	opts->useConditionals = getBoolIfExists(d, "/use conditionals");
+	opts->exactEvaluation = getBoolIfExists(d, "/exact evaluation");
+	opts->adaptiveSimulations = getBoolIfExists(d, "/adaptive sims");
+	opts->commonRandomNumbers = getBoolIfExists(d, "/common random numbers");
+
+	const string sampling = getStringIfExists(d, "/sampling", "random");
+	if (lowercase(sampling) == "random") opts->sampling = samplingMethod::random;
+	else if (lowercase(sampling) == "antithetic") opts->sampling = samplingMethod::antithetic;
+	else if (lowercase(sampling) == "stratified") opts->sampling = samplingMethod::stratified;
+	else if (lowercase(sampling) == "importance") opts->sampling = samplingMethod::importance;
+	else
+	{
+		cerr << "unknown sampling '" << sampling << "'" << endl;
+		exit(1);
+	}
+
+	opts->verifyCandidates = getIntIfExists(d, "/verify candidates");
+	opts->verifySimulations = getIntIfExists(d, "/verify sims", 10 * opts->simsPerSequence);
 
 	opts->selectionPressure = getDoubleIfExists(d, "/selection pressure", 2.0);
 
@@ -453,7 +479,8 @@ int performSingle(const crafterStats& crafter, const recipeStats& recipe,
 	int initialQuality, bool normalLock)
 {
 	randomGenerator rng;
-	craft synth(initialQuality, crafter, recipe, normalLock);
+	const craft::context craftContext(crafter, recipe, normalLock);
+	craft synth(initialQuality, craftContext);
 	synth.setRNG(&rng);
 
 	craft::endResult result = synth.performAll(sequence, goal, true);
@@ -482,11 +509,23 @@ int performSingle(const crafterStats& crafter, const recipeStats& recipe,
 int performMulti(const crafterStats& crafter, const recipeStats& recipe,
 	const craft::sequenceType& sequence, goalType goal,
 	int initialQuality, bool normalLock,
-	int threads, int simsPerSequence)
+	int threads, int simsPerSequence, samplingMethod sampling)
 {
 	solver solve(crafter, recipe, sequence, goal, initialQuality, threads, normalLock);
+	solve.setSampling(sampling);
 
 	solver::netResult result = solve.executeMultisim(simsPerSequence).outcome;
+	const solver::standardErrors& errors = solve.getStandardErrors();
+
+	if (sampling == samplingMethod::importance)
+	{
+		// The sims were pushed toward failing, so nothing but the weighted failure rate is worth showing
+		const solver::failureEstimate& failures = solve.getFailureEstimate();
+		cout << "Failure rate: " << failures.rate * 100 << "% (95% confidence: " <<
+			max(0.0, failures.rate - 1.96 * failures.standardError) * 100 << "% to " <<
+			min(1.0, failures.rate + 1.96 * failures.standardError) * 100 << "%)\n";
+		return 0;
+	}
 
 	cout << result.successes << " completed (" << (result.successes * 100) / simsPerSequence << "%)\n";
 	switch (goal)
@@ -506,10 +545,27 @@ int performMulti(const crafterStats& crafter, const recipeStats& recipe,
 	}
 	cout << result.steps / simsPerSequence << " average step" << (result.steps == 1 ? "" : "s") << ", " << result.invalidActions / simsPerSequence << " average invalid actions\n";
 
+	cout << "Standard error: " << errors.successes * 100 << "% completed, ";
+	switch (goal)
+	{
+	case goalType::hq:
+		cout << errors.goal << "% HQ\n";
+		break;
+	case goalType::maxQuality:
+		cout << errors.goal << " quality\n";
+		break;
+	case goalType::collectability:
+		cout << errors.goal * 100 << "% reached goal\n";
+		break;
+	case goalType::points:
+		cout << errors.goal << " points\n";
+		break;
+	}
+
 	return 0;
 }
 
-bool solveUpdate(int generations, int currentGeneration, int simsPerTrial, goalType goal, strategy strat, solver::trial status, int uniquePopulation, int cacheHits)
+bool solveUpdate(int generations, int currentGeneration, int simsPerTrial, goalType goal, strategy strat, solver::trial status, int uniquePopulation, int cacheHits, int simsSaved, int copySims)
 {
 	if (termFlag) return false;
 
@@ -548,6 +604,10 @@ bool solveUpdate(int generations, int currentGeneration, int simsPerTrial, goalT
 		cout << ", " << uniquePopulation << " unique";
 	if (cacheHits > 0)
 		cout << ", " << cacheHits << " cache hits";
+	if (simsSaved > 0)
+		cout << ", " << simsSaved << " sims saved";
+	if (copySims > 0)
+		cout << ", " << copySims << " sims on copies avoided";
 
 	cout << endl;
 
@@ -567,8 +627,14 @@ int performSolve(const crafterStats& crafter,
 	int generations,
 	int population,
 	int maxCacheSize,
+	const string& cacheFile,
 	strategy strat,
 	bool useConditionals,
+	bool exactEvaluation,
+	bool adaptiveSimulations,
+	bool commonRandomNumbers,
+	int verifyCandidates,
+	int verifySimulations,
 	bool gatherStats,
 	double selectionPressure)
 {
@@ -576,6 +642,15 @@ int performSolve(const crafterStats& crafter,
 
 	solver solve(crafter, recipe, sequence, goal, initialQuality, threads, normalLock,
 		strat, population, useConditionals, gatherStats, selectionPressure);
+	solve.setExactEvaluation(exactEvaluation);
+	solve.setAdaptiveSimulations(adaptiveSimulations);
+	solve.setCommonRandomNumbers(commonRandomNumbers);
+	solve.setVerification(verifyCandidates, verifySimulations);
+	if (!cacheFile.empty() && !solve.setCacheFile(cacheFile, maxCacheSize))
+	{
+		cerr << "failed to open cache file " << cacheFile << endl;
+		exit(1);
+	}
 	
 	solver::trial result = solve.executeSolver(simsPerSequence, generations, 0, 0, maxCacheSize, solveUpdate);
 	solver::netResult outcome = result.outcome;
@@ -602,6 +677,44 @@ int performSolve(const crafterStats& crafter,
 	cout << sequenceToString(result.sequence);
 	cout << endl;
 
+	const vector<solver::verifiedCandidate>& verified = solve.getVerified();
+	if (!verified.empty())
+	{
+		// 95% confidence ranges, from how much the verification's independent replicates disagree
+		auto printRange = [](double average, double error, double scale, const char* unit)
+			{
+				cout << average * scale << unit << " (95% confidence: " << (average - 1.96 * error) * scale << unit <<
+					" to " << (average + 1.96 * error) * scale << unit << ")";
+			};
+
+		cout << "\nBest " << verified.size() << " checked with " << verifySimulations << " sims each:\n";
+		for (const solver::verifiedCandidate& v : verified)
+		{
+			const solver::netResult& o = v.candidate.outcome;
+			const double sims = o.simulations;
+			printRange(o.successes / sims, v.errors.successes, 100, "% completed");
+			cout << ", ";
+			switch (goal)
+			{
+			case goalType::hq:
+				printRange(o.hqPercent / sims, v.errors.goal, 1, "% HQ");
+				break;
+			case goalType::maxQuality:
+				printRange(o.quality / sims, v.errors.goal, 1, " quality");
+				break;
+			case goalType::collectability:
+				printRange(o.collectableGoalsHit / sims, v.errors.goal, 100, "% reached goal");
+				break;
+			case goalType::points:
+				printRange(o.points / sims, v.errors.goal, 1, " points");
+				break;
+			}
+			craft::sequenceType sequence = v.candidate.sequence;
+			cout << '\n' << sequenceToString(sequence) << '\n';
+		}
+		cout << endl;
+	}
+
 	if (gatherStats)
 	{
 		cout << '\n';
@@ -610,6 +723,13 @@ int performSolve(const crafterStats& crafter,
 		cout << "Removals: " << result.stats.removals << '\n';
 		cout << "Shifts: " << result.stats.shifts << '\n';
 		cout << "Swaps: " << result.stats.swaps << "\n\n";
+
+		// Only ranking runs on the main thread alone; the rest is split between the threads
+		const solver::phaseTimes& times = solve.getPhaseTimes();
+		cout << "Cache lookups: " << times.lookup << "s\n";
+		cout << "Simulation: " << times.simulate << "s\n";
+		cout << "Ranking: " << times.rank << "s\n";
+		cout << "Mutation: " << times.mutate << "s\n";
 		
 		cout << endl;
 	}
@@ -923,15 +1043,16 @@ int main(int argc, char* argv[])
 	case commands::single:
 		return performSingle(crafter, recipe, seed, goal, initialQuality, opts.normalLock);
 	case commands::multi:
-		return performMulti(crafter, recipe, seed, goal, initialQuality, opts.normalLock, opts.threads, opts.simsPerSequence);
+		return performMulti(crafter, recipe, seed, goal, initialQuality, opts.normalLock, opts.threads, opts.simsPerSequence, opts.sampling);
 	case commands::solve:
 		return performSolve(crafter, recipe, seed, goal, initialQuality, opts.normalLock, opts.threads, opts.simsPerSequence,
-			opts.generations, opts.population, opts.maxCacheSize, strat, opts.useConditionals, gatherStatistics, opts.selectionPressure);
+			opts.generations, opts.population, opts.maxCacheSize, opts.cacheFile, strat, opts.useConditionals, opts.exactEvaluation, opts.adaptiveSimulations, opts.commonRandomNumbers,
+			opts.verifyCandidates, opts.verifySimulations, gatherStatistics, opts.selectionPressure);
 	case commands::stepwise:
 		return performStepwise(crafter, recipe, seed, goal, initialQuality, opts.threads,
-			opts.simsPerSequence, opts.stepwiseGenerations, opts.population, opts.maxCacheSize, strat, opts.selectionPressure);
+			opts.simsPerSequence, opts.stepwiseGenerations, opts.population, opts.maxCacheSize, opts.cacheFile, strat, opts.selectionPressure);
 	case commands::autostepwise:
 		return performAutoStepwise(crafter, recipe, seed, goal, initialQuality, opts.threads,
-			opts.simsPerSequence, opts.stepwiseGenerations, opts.population, opts.maxCacheSize, strat, opts.selectionPressure);
+			opts.simsPerSequence, opts.stepwiseGenerations, opts.population, opts.maxCacheSize, opts.cacheFile, strat, opts.selectionPressure);
 	}
 }
\ No newline at end of file
@@ -21,6 +21,11 @@ extern "C"
 #define AT_GOAL_COLLECTABILITY 2	/* Maximize number of crafts that reach the goal */
 #define AT_GOAL_POINTS 3			/* Maximize the average number of turnin points */
 
+#define AT_SAMPLING_RANDOM 0		/* Independent simulations */
+#define AT_SAMPLING_ANTITHETIC 1	/* Simulations in pairs, the second with every success roll mirrored */
+#define AT_SAMPLING_STRATIFIED 2	/* Each step's rolls spread evenly over the simulations */
+#define AT_SAMPLING_IMPORTANCE 3	/* Simulations pushed toward failing. Only atGetFailureEstimate's result is meaningful */
+
 
 #define AT_SYNTH_BASICSYNTH 100
 #define AT_SYNTH_CAREFULSYNTH 101
@@ -119,6 +124,8 @@ atSolver* atInitSolver(
 );
 	
 /* You must provide both .csv files before you can begin solving! Returns 0 on success, 1 on failure */
+/* Load it before atInitSolver, which takes the recipe's conditions (and whether it's expert) from it. Without it, */
+/* only expert rLevels 513 and 611 get their conditions, and every other recipe gets the normal ones */
 int atLoadRecipeTable(const char* filename);		/* e.g. RecipeLevelTable.csv */
 
 /* This function will be called after every generation. Return 0 to continue solving, non-0 to stop early. */
@@ -135,6 +142,69 @@ atSolverResult atExecuteSimulations(
 	int numberOfSimulations
 );
 
+/* Solvers share one pool of worker threads. When several run at once, one with twice the priority of another */
+/* gets twice its turns at the threads. 1 if never called. Must be > 0 */
+void atSetPriority(
+	atSolver* solver,
+	int priority
+);
+
+/* How atExecuteSimulations draws its simulations' luck. One of AT_SAMPLING_*. AT_SAMPLING_RANDOM if never called */
+void atSetSampling(
+	atSolver* solver,
+	int sampling
+);
+
+/* Keeps the solver's cache in a file, so later runs and other processes using the same file share its results. */
+/* The file is made to hold maxCacheSize results if it doesn't exist. atExecuteSolve's maxCacheSize is ignored after */
+/* this succeeds. maxCacheSize must be > 0, even for an existing file. Returns 0 on success, 1 on failure */
+int atSetCacheFile(
+	atSolver* solver,
+	const char* filename,
+	int maxCacheSize
+);
+
+/* At the end of atExecuteSolve, simulates its best few different sequences again with more simulations each, and */
+/* returns whichever does best on those, its results scaled to simulationsPerSequence. A solve stopped by its callback */
+/* skips it. 0 candidates (the default) turns it off. atGetVerified gives every sequence checked, with its standard errors */
+void atSetVerification(
+	atSolver* solver,
+	int candidates,
+	int simulations
+);
+
+struct atStandardErrors		/* How far off the averages of the last atExecuteSimulations could be */
+{
+	double successRate;		/* Of the success rate, from 0 to 1 */
+	double goal;			/* Of the average HQ%, quality, collectable hit rate (0 to 1) or points */
+};
+
+atStandardErrors atGetStandardErrors(atSolver* solver);
+
+struct atFailureEstimate	/* From the last atExecuteSimulations with AT_SAMPLING_IMPORTANCE */
+{
+	double rate;			/* The chance of failing the craft, from 0 to 1 */
+	double standardError;
+};
+
+atFailureEstimate atGetFailureEstimate(atSolver* solver);
+
+struct atVerifiedCandidate	/* One of the sequences the last atExecuteSolve's verification checked (see atSetVerification) */
+{
+	atSolverResult result;		/* Summed over simulations, not simulationsPerSequence */
+	int simulations;
+	atStandardErrors errors;	/* 0 for one worked out exactly */
+};
+
+/* How many sequences the last atExecuteSolve verified. 0 if it didn't */
+int atGetVerifiedCount(atSolver* solver);
+
+/* Best first, so index 0 is what atExecuteSolve returned. index must be from 0 to atGetVerifiedCount - 1 */
+atVerifiedCandidate atGetVerified(
+	atSolver* solver,
+	int index
+);
+
 atSolverResult atExecuteSolve(
 	atSolver* solver,
 	int simulationsPerSequence,		/* The number of times each prospective result is simulated. Must be > 0. */
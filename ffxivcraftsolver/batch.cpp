@@ -0,0 +1,260 @@
+#include <cassert>
+#include <limits>
+#include "batch.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static_assert(static_cast<int>(craft::condition::poor) == batchPoor &&
+	static_cast<int>(craft::condition::normal) == batchNormal &&
+	static_cast<int>(craft::condition::good) == batchGood &&
+	static_cast<int>(craft::condition::excellent) == batchExcellent &&
+	static_cast<int>(craft::condition::centered) == batchCentered &&
+	static_cast<int>(craft::condition::sturdy) == batchSturdy &&
+	static_cast<int>(craft::condition::pliant) == batchPliant &&
+	static_cast<int>(craft::condition::malleable) == batchMalleable &&
+	static_cast<int>(craft::condition::primed) == batchPrimed &&
+	static_cast<int>(craft::condition::goodomen) == batchGoodOmen,
+	"batchCondition must match craft::condition");
+
+void performBatchBaseline(const batchInput& in, batchOutput& out)
+{
+	runBatch<8>(in, out);
+}
+
+bool cpuHasAVX2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	// The OS has to save the YMM registers too
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+int timerIndex(short craft::state::* timer)
+{
+	if (timer == nullptr) return -1;
+	if (timer == &craft::state::muscleMemoryTime) return batchMuscleMemory;
+	if (timer == &craft::state::wasteNotTime) return batchWasteNot;
+	if (timer == &craft::state::wasteNot2Time) return batchWasteNot2;
+	if (timer == &craft::state::manipulationTime) return batchManipulation;
+	if (timer == &craft::state::venerationTime) return batchVeneration;
+	if (timer == &craft::state::greatStridesTime) return batchGreatStrides;
+	if (timer == &craft::state::innovationTime) return batchInnovation;
+	if (timer == &craft::state::finalAppraisalTime) return batchFinalAppraisal;
+	return -2;	// not a timer the kernel knows about
+}
+
+int comboIndex(bool craft::state::* combo)
+{
+	if (combo == nullptr) return -1;
+	if (combo == &craft::state::basicTouchCombo) return batchBasicTouch;
+	if (combo == &craft::state::standardTouchCombo) return batchStandardTouch;
+	if (combo == &craft::state::observeCombo) return batchObserve;
+	return -2;
+}
+
+batchSimulator::batchSimulator(const craft& initial) :
+	initialState(initial),
+	input{},
+	sequence(nullptr),
+	start{},
+	batchable(false)
+{
+	static const bool avx2 = cpuHasAVX2();
+	kernel = avx2 ? performBatchAVX2 : performBatchBaseline;
+	lanes = avx2 ? 16 : 8;
+
+	const craft::context& ctx = initial.getContext();
+	input.progressTable = ctx.progressTable();
+	input.qualityTable = ctx.qualityTable();
+	input.progressEfficiencies = static_cast<int>(craft::context::progressEfficiencies);
+	input.qualityEfficiencies = static_cast<int>(craft::context::qualityEfficiencies);
+	input.maxInnerQuiet = craft::context::maxInnerQuiet;
+	for (size_t i = 0; i < ctx.conditionByRoll.size(); ++i)
+		input.conditionByRoll[i] = static_cast<int>(ctx.conditionByRoll[i]);
+
+	input.difficulty = ctx.recipe.difficulty;
+	input.maxDurability = ctx.recipe.durability;
+	input.maxCP = ctx.crafter.CP;
+	input.nominalQuality = ctx.recipe.nominalQuality;
+	input.gainsInnerQuiet = ctx.crafter.level >= 11;
+	input.expert = ctx.recipe.expert;
+	input.normalLock = ctx.normalLock;
+}
+
+void batchSimulator::setSequence(const craft::sequenceType& seq, const craft::snapshot& from)
+{
+	sequence = &seq;
+	start = from;
+
+	const craft::context& ctx = initialState.getContext();
+	const craft::state& s = from.current;
+	batchable = s.innerQuiet >= 0 && s.innerQuiet <= craft::context::maxInnerQuiet;
+
+	input.step = s.step;
+	input.durability = s.durability;
+	input.CP = s.CP;
+	input.quality = s.quality;
+	input.progress = s.progress;
+	input.innerQuiet = s.innerQuiet;
+	input.condition = static_cast<int>(s.cond);
+	input.timers[batchMuscleMemory] = s.muscleMemoryTime;
+	input.timers[batchWasteNot] = s.wasteNotTime;
+	input.timers[batchWasteNot2] = s.wasteNot2Time;
+	input.timers[batchManipulation] = s.manipulationTime;
+	input.timers[batchVeneration] = s.venerationTime;
+	input.timers[batchGreatStrides] = s.greatStridesTime;
+	input.timers[batchInnovation] = s.innovationTime;
+	input.timers[batchFinalAppraisal] = s.finalAppraisalTime;
+	input.combos[batchBasicTouch] = s.basicTouchCombo;
+	input.combos[batchStandardTouch] = s.standardTouchCombo;
+	input.combos[batchObserve] = s.observeCombo;
+
+	input.firstAction = from.position == 0;
+	input.firstInvalid = from.firstInvalid || (from.position == 0 && !seq.empty() && seq.front() == actions::finalAppraisal && s.finalAppraisalTime == 5);
+	input.invalidActions = from.invalidActions;
+	input.softInvalids = from.softInvalids;
+
+	const int progressStep = craft::context::progressEfficiencyStep;
+	const int qualityStep = craft::context::qualityEfficiencyStep;
+
+	steps.resize(seq.size() - from.position);
+	for (size_t i = 0; i < steps.size(); ++i)
+	{
+		const craft::actionDescriptor& d = ctx.actionTable[static_cast<size_t>(seq[from.position + i])];
+		batchStep& b = steps[i];
+		b.CPCost = d.CPCost;
+		b.comboCPCost = d.comboCPCost;
+		b.successChance = d.successChance;
+		b.comboSuccessChance = d.comboSuccessChance;
+		b.progressIndex = d.progressEfficiency / progressStep;
+		b.halvedProgressIndex = (d.progressEfficiency / 2) / progressStep;
+		b.qualityIndex = d.qualityEfficiency / qualityStep;
+		b.qualityIndexPerInnerQuiet = d.qualityPerInnerQuiet / qualityStep;
+		b.durabilityCost = d.durabilityCost;
+		b.durabilityRestored = d.durabilityRestored;
+		b.combo = comboIndex(d.combo);
+		b.startsCombo = comboIndex(d.startsCombo);
+		b.buff = timerIndex(d.buff);
+		b.buffDuration = d.buffDuration;
+		b.buffCleared = timerIndex(d.buffCleared);
+		b.minimumInnerQuiet = d.minimumInnerQuiet;
+		b.innerQuietGained = d.innerQuietGained;
+		b.innerQuietAfter = d.innerQuietAfter;
+		b.available = d.available;
+		b.firstStepOnly = d.firstStepOnly;
+		b.blockedByWasteNot = d.blockedByWasteNot;
+		b.needsGoodCondition = d.needsGoodCondition;
+		b.halvedWithoutDurability = d.halvedWithoutDurability;
+		b.addsRecipeQuality = d.addsRecipeQuality;
+		b.endsStep = d.endsStep;
+		b.rolls = d.successChance < 100 || (d.combo != nullptr && d.comboSuccessChance < 100);
+
+		// The kernel only does table lookups, so every efficiency it can ask for has to be in them
+		const int mostQuality = d.qualityEfficiency + d.qualityPerInnerQuiet * craft::context::maxInnerQuiet;
+		if (d.progressEfficiency < 0 || d.progressEfficiency > craft::context::maxProgressEfficiency ||
+			d.progressEfficiency % progressStep != 0 ||
+			(d.halvedWithoutDurability && (d.progressEfficiency / 2) % progressStep != 0) ||
+			d.qualityEfficiency < 0 || d.qualityPerInnerQuiet < 0 || mostQuality > craft::context::maxQualityEfficiency ||
+			d.qualityEfficiency % qualityStep != 0 || d.qualityPerInnerQuiet % qualityStep != 0 ||
+			b.combo < -1 || b.startsCombo < -1 || b.buff < -1 || b.buffCleared < -1)
+			batchable = false;
+	}
+
+	input.steps = steps.data();
+	input.length = static_cast<int>(steps.size());
+}
+
+void batchSimulator::simulate(int count, goalType goal, randomGenerator& rng, craft::endResult* results)
+{
+	assert(sequence != nullptr && count <= lanes);
+
+	if (!batchable)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			craft synth(initialState);
+			synth.setRNG(&rng);
+			results[i] = synth.performFrom(*sequence, start, goal);
+		}
+		return;
+	}
+
+	// One draw per batch, spread over the lanes
+	splitmix64 seeder(rng.generateInt<uint64_t>(numeric_limits<uint64_t>::max() - 1));
+	for (int l = 0; l < lanes; ++l)
+	{
+		const uint64_t a = seeder(), b = seeder();
+		input.seeds[0][l] = static_cast<uint32_t>(a);
+		input.seeds[1][l] = static_cast<uint32_t>(a >> 32);
+		input.seeds[2][l] = static_cast<uint32_t>(b);
+		input.seeds[3][l] = static_cast<uint32_t>(b >> 32) | 1;	// never all zero
+	}
+	input.luck = nullptr;
+	input.count = count;
+
+	runKernel(count, goal, results, nullptr);
+}
+
+void batchSimulator::simulate(int count, goalType goal, const luckTapes& luck, int firstTape, craft::endResult* results, double* weights)
+{
+	assert(sequence != nullptr && count <= lanes && firstTape + count <= luck.count());
+
+	if (!batchable)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			craft synth(initialState);
+			synth.setLuck(&luck, firstTape + i);
+			results[i] = synth.performFrom(*sequence, start, goal);
+			if (weights != nullptr) weights[i] = synth.getLuckWeight();
+		}
+		return;
+	}
+
+	input.luck = luck.at(0, luckTapes::successRoll) + firstTape;
+	input.luckStride = luck.count();
+	input.luckSteps = luck.length();
+	input.successRatios = luck.ratioTable(luckTapes::successRoll);
+	input.conditionRatios = luck.ratioTable(luckTapes::conditionRoll);
+	input.count = count;
+
+	runKernel(count, goal, results, weights);
+}
+
+void batchSimulator::runKernel(int count, goalType goal, craft::endResult* results, double* weights)
+{
+	batchOutput output;
+	kernel(input, output);
+
+	const int goalQuality = initialState.getContext().recipe.quality;
+	for (int i = 0; i < count; ++i)
+	{
+		craft synth(initialState);
+		synth.setProgress(output.progress[i]);
+		synth.setQuality(output.quality[i]);
+		synth.setStep(output.steps[i]);
+		results[i] = synth.getResult(goal);
+		results[i].invalidActions = output.invalidActions[i] + (output.quality[i] < goalQuality ? output.softInvalids[i] : 0);
+		results[i].firstInvalid = output.firstInvalid[i];
+		if (weights != nullptr) weights[i] = output.weight[i];
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include "craft.h"
+#include "batchkernel.h"
+
+// Simulates one sequence over several independent random streams at once, stepping them in lockstep
+// with the craft's state kept per lane so each action runs as vector code. AVX2 is used when the CPU has it.
+class batchSimulator
+{
+private:
+	const craft& initialState;
+	batchInput input;
+	std::vector<batchStep> steps;
+	const craft::sequenceType* sequence;
+	craft::snapshot start;
+	bool batchable;	// false if anything would fall outside the context's tables, in which case craft::performFrom is used
+
+	void (*kernel)(const batchInput&, batchOutput&);
+	int lanes;
+
+	void runKernel(int count, goalType goal, craft::endResult* results, double* weights);
+
+public:
+	batchSimulator() = delete;
+	batchSimulator(const batchSimulator&) = delete;
+	batchSimulator& operator=(const batchSimulator&) = delete;
+
+	// The craft must outlive the simulator
+	explicit batchSimulator(const craft& initial);
+
+	// How many sims one call to simulate can do
+	int width() const { return lanes; }
+
+	// The sequence must outlive any calls to simulate with it. Sims start from the snapshot, which must be one of the sequence
+	void setSequence(const craft::sequenceType& seq, const craft::snapshot& from);
+
+	// Runs count (at most width()) sims of the sequence, writing one result for each
+	void simulate(int count, goalType goal, randomGenerator& rng, craft::endResult* results);
+	// The same, but sim i replays tape firstTape + i. If weights is given, it gets what each result is worth (see luckTapes::drawWeighted)
+	void simulate(int count, goalType goal, const luckTapes& luck, int firstTape, craft::endResult* results, double* weights = nullptr);
+};
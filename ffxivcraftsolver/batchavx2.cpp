@@ -0,0 +1,17 @@
+// This file is compiled with AVX2 enabled (set per file in the project), and only called when the CPU supports it
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#pragma GCC target("avx2")
+#elif defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#endif
+
+#include "batchkernel.h"
+
+void performBatchAVX2(const batchInput& in, batchOutput& out)
+{
+	runBatch<16>(in, out);
+}
+
+#if defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#pragma clang attribute pop
+#endif
@@ -0,0 +1,474 @@
+#pragma once
+#include <cstdint>
+
+/*
+The lockstep kernel behind batch.h. It's compiled once per instruction set (batch.cpp for the baseline,
+batchavx2.cpp with AVX2 enabled), so this header must not pull in anything that instantiates code,
+and the kernel itself lives in an anonymous namespace so each translation unit keeps its own copy.
+Everything is written as plain loops over the lanes so the compiler can turn each one into vector code.
+*/
+
+const int maxBatchLanes = 16;
+
+// The same values as craft::condition, checked in batch.cpp
+enum batchCondition
+{
+	batchPoor,
+	batchNormal,
+	batchGood,
+	batchExcellent,
+	batchCentered,
+	batchSturdy,
+	batchPliant,
+	batchMalleable,
+	batchPrimed,
+	batchGoodOmen
+};
+
+enum batchTimer
+{
+	batchMuscleMemory,
+	batchWasteNot,
+	batchWasteNot2,
+	batchManipulation,
+	batchVeneration,
+	batchGreatStrides,
+	batchInnovation,
+	batchFinalAppraisal,
+	batchTimers
+};
+
+enum batchCombo
+{
+	batchBasicTouch,
+	batchStandardTouch,
+	batchObserve,
+	batchCombos
+};
+
+// One action of the sequence, flattened out of its craft::actionDescriptor. Efficiencies are already divided into
+// table indexes, combos and buffs are indexes with -1 for none, and flags are 0 or 1 so they can be used as masks.
+struct batchStep
+{
+	int CPCost;
+	int comboCPCost;
+	int successChance;
+	int comboSuccessChance;
+	int progressIndex;			// 0 if the action doesn't add progress
+	int halvedProgressIndex;	// used instead without enough durability
+	int qualityIndex;			// 0 (along with qualityIndexPerInnerQuiet) if the action doesn't add quality
+	int qualityIndexPerInnerQuiet;
+	int durabilityCost;
+	int durabilityRestored;
+	int combo;
+	int startsCombo;
+	int buff;
+	int buffDuration;
+	int buffCleared;
+	int minimumInnerQuiet;
+	int innerQuietGained;
+	int innerQuietAfter;
+	int available;
+	int firstStepOnly;
+	int blockedByWasteNot;
+	int needsGoodCondition;
+	int halvedWithoutDurability;
+	bool addsRecipeQuality;
+	bool endsStep;
+	bool rolls;		// if either success chance is under 100
+};
+
+struct batchInput
+{
+	// craft::context's tables
+	const int* progressTable;
+	const int* qualityTable;
+	int progressEfficiencies;
+	int qualityEfficiencies;
+	int maxInnerQuiet;
+	int conditionByRoll[100];
+
+	int difficulty;
+	int maxDurability;
+	int maxCP;
+	int nominalQuality;
+	int gainsInnerQuiet;	// from increasing quality, which needs level 11
+	int expert;
+	int normalLock;
+
+	const batchStep* steps;
+	int length;
+
+	// The starting state, the same for every lane
+	int step;
+	int durability;
+	int CP;
+	int quality;
+	int progress;
+	int innerQuiet;
+	int condition;
+	int timers[batchTimers];
+	int combos[batchCombos];
+	// What the sequence has tallied before steps[0]
+	int firstAction;	// whether steps[0] is the sequence's first action
+	int firstInvalid;	// e.g. final appraisal that's already up
+	int invalidActions;
+	int softInvalids;
+
+	int count;	// lanes past this are ignored
+	uint32_t seeds[4][maxBatchLanes];
+	// If set, lanes replay luck tapes instead of drawing from the seeds: lane l's roll of a kind at a step
+	// is luck[(min(step, luckSteps - 1) * 2 + kind) * luckStride + l], the same layout as luckTapes
+	const uint8_t* luck;
+	int luckStride;
+	int luckSteps;
+	// luckTapes::ratioTable for each kind. Each roll a lane uses multiplies its weight by the roll's ratio
+	const float* successRatios;
+	const float* conditionRatios;
+};
+
+struct batchOutput
+{
+	int progress[maxBatchLanes];
+	int quality[maxBatchLanes];
+	int steps[maxBatchLanes];
+	int invalidActions[maxBatchLanes];
+	int softInvalids[maxBatchLanes];	// craft::performAll only counts these against crafts that miss the quality target, so that's left to the caller
+	bool firstInvalid[maxBatchLanes];
+	float weight[maxBatchLanes];	// 1 unless the luck tapes are weighted
+};
+
+// batch.cpp picks between these
+void performBatchBaseline(const batchInput& in, batchOutput& out);
+void performBatchAVX2(const batchInput& in, batchOutput& out);
+
+namespace
+{
+	// xoshiro128**, one stream per lane
+	template<int lanes>
+	inline void rollLanes(uint32_t (&s)[4][lanes], int32_t (&roll)[lanes])
+	{
+		for (int l = 0; l < lanes; ++l)
+		{
+			const uint32_t m = s[1][l] * 5;
+			const uint32_t result = ((m << 7) | (m >> 25)) * 9;
+			const uint32_t t = s[1][l] << 9;
+
+			s[2][l] ^= s[0][l];
+			s[3][l] ^= s[1][l];
+			s[1][l] ^= s[2][l];
+			s[0][l] ^= s[3][l];
+			s[2][l] ^= t;
+			s[3][l] = (s[3][l] << 11) | (s[3][l] >> 21);
+
+			// 0-99 from the top 24 bits. The bias is a few parts per million, where a rejection loop can't be done in lockstep
+			roll[l] = static_cast<int32_t>(((result >> 8) * 100) >> 24);
+		}
+	}
+
+
+	// What an action's durability cost comes to for each lane, as craft::getDurabilityCost
+	template<int lanes>
+	inline void durabilityCosts(int32_t base, const int32_t* wasteNot, const int32_t* wasteNot2, const int32_t* cond, int32_t (&cost)[lanes])
+	{
+		for (int l = 0; l < lanes; ++l)
+		{
+			const int32_t halved = base - ((wasteNot[l] > 0) | (wasteNot2[l] > 0)) * (base >> 1);
+			cost[l] = halved - (cond[l] == batchSturdy) * (halved >> 1);
+		}
+	}
+
+	// kind is 0 for a success roll or 1 for a condition roll, as luckTapes::rollKind
+	template<int lanes>
+	inline void replayLanes(const batchInput& in, int kind, const int32_t (&step)[lanes], int32_t (&roll)[lanes])
+	{
+		const int32_t last = in.luckSteps - 1;
+		for (int l = 0; l < lanes; ++l)
+		{
+			const int32_t at = step[l] < last ? step[l] : last;
+			const int32_t lane = l < in.count ? l : 0;	// the tapes may end before the lanes do
+			roll[l] = in.luck[(at * 2 + kind) * in.luckStride + lane];
+		}
+	}
+
+	// Every lane loop below only selects between values it has already computed, with any branching
+	// on the action itself hoisted out, so that each one vectorizes.
+	template<int lanes>
+	void runBatch(const batchInput& in, batchOutput& out)
+	{
+		alignas(64) int32_t step[lanes], durability[lanes], CP[lanes], quality[lanes], progress[lanes], innerQuiet[lanes], cond[lanes];
+		alignas(64) int32_t timers[batchTimers][lanes];
+		alignas(64) int32_t combos[batchCombos][lanes];
+		alignas(64) int32_t noCombo[lanes];
+		alignas(64) int32_t live[lanes], invalid[lanes], softInvalid[lanes], firstInvalid[lanes];
+		alignas(64) int32_t acted[lanes], succeeded[lanes], active[lanes], kept[lanes], roll[lanes], cost[lanes], used[lanes];
+		alignas(64) float weight[lanes];
+		alignas(64) uint32_t rng[4][lanes];
+
+		for (int l = 0; l < lanes; ++l)
+		{
+			step[l] = in.step;
+			durability[l] = in.durability;
+			CP[l] = in.CP;
+			quality[l] = in.quality;
+			progress[l] = in.progress;
+			innerQuiet[l] = in.innerQuiet;
+			cond[l] = in.condition;
+			noCombo[l] = 0;
+			live[l] = l < in.count;
+			invalid[l] = in.invalidActions;
+			softInvalid[l] = in.softInvalids;
+			firstInvalid[l] = in.firstInvalid;
+			roll[l] = 0;
+			weight[l] = 1.f;
+		}
+		for (int t = 0; t < batchTimers; ++t)
+			for (int l = 0; l < lanes; ++l)
+				timers[t][l] = in.timers[t];
+		for (int c = 0; c < batchCombos; ++c)
+			for (int l = 0; l < lanes; ++l)
+				combos[c][l] = in.combos[c];
+		for (int r = 0; r < 4; ++r)
+			for (int l = 0; l < lanes; ++l)
+				rng[r][l] = in.seeds[r][l];
+
+		// Copied out so the compiler knows nothing in the loops below can change them
+		const int32_t maxCP = in.maxCP, maxDurability = in.maxDurability, difficulty = in.difficulty, nominalQuality = in.nominalQuality;
+		const int32_t maxInnerQuiet = in.maxInnerQuiet, gainsInnerQuiet = in.gainsInnerQuiet, expert = in.expert, normalLock = in.normalLock;
+		const int32_t progressEfficiencies = in.progressEfficiencies, qualityEfficiencies = in.qualityEfficiencies;
+		const int* const progressTable = in.progressTable;
+		const int* const qualityTable = in.qualityTable;
+		const int* const conditionByRoll = in.conditionByRoll;
+		const float* const successRatios = in.luck != nullptr ? in.successRatios : nullptr;
+		const float* const conditionRatios = in.luck != nullptr ? in.conditionRatios : nullptr;
+
+		int32_t* const wasteNot = timers[batchWasteNot];
+		int32_t* const wasteNot2 = timers[batchWasteNot2];
+
+		for (int k = 0; k < in.length; ++k)
+		{
+			const batchStep s = in.steps[k];
+			int32_t* const combo = s.combo >= 0 ? combos[s.combo] : noCombo;
+
+			if (s.rolls)
+			{
+				if (in.luck != nullptr) replayLanes(in, 0, step, roll);
+				else rollLanes(rng, roll);
+			}
+
+			// Preconditions, CP and the success roll
+			{
+				const int32_t first = (k == 0) & in.firstAction;
+				for (int l = 0; l < lanes; ++l)
+				{
+					const int32_t hard = (s.available ^ 1) |
+						(s.firstStepOnly & (step[l] != 1)) |
+						(s.blockedByWasteNot & ((wasteNot[l] > 0) | (wasteNot2[l] > 0))) |
+						(innerQuiet[l] < s.minimumInnerQuiet);
+					const int32_t soft = (hard ^ 1) & s.needsGoodCondition & (cond[l] != batchGood) & (cond[l] != batchExcellent);
+
+					const int32_t comboActive = combo[l];
+					int32_t price = comboActive ? s.comboCPCost : s.CPCost;
+					price -= ((price > 0) & (cond[l] == batchPliant)) * (price >> 1);
+					const int32_t noCP = ((hard | soft) ^ 1) & (price > CP[l]);
+
+					const int32_t act = live[l] & ((hard | soft | noCP) ^ 1);
+					const int32_t newCP = CP[l] - price;
+					CP[l] = act ? (newCP < maxCP ? newCP : maxCP) : CP[l];
+
+					const int32_t chance = (comboActive ? s.comboSuccessChance : s.successChance) + (cond[l] == batchCentered) * 25;
+					acted[l] = act;
+					succeeded[l] = act & ((chance >= 100) | (roll[l] < chance));
+					used[l] = act & (chance < 100);
+
+					invalid[l] += live[l] & (hard | noCP);
+					softInvalid[l] += live[l] & soft;
+					firstInvalid[l] |= first & live[l] & (act ^ 1);
+				}
+			}
+			if (s.rolls && successRatios != nullptr)
+				for (int l = 0; l < lanes; ++l)
+					weight[l] *= used[l] ? successRatios[roll[l]] : 1.f;
+
+			if (s.progressIndex > 0)
+			{
+				int32_t* const muscleMemory = timers[batchMuscleMemory];
+				int32_t* const veneration = timers[batchVeneration];
+				int32_t* const finalAppraisal = timers[batchFinalAppraisal];
+				durabilityCosts(s.durabilityCost, wasteNot, wasteNot2, cond, cost);
+				for (int l = 0; l < lanes; ++l)
+				{
+					const int32_t index = (s.halvedWithoutDurability & (durability[l] < cost[l])) ? s.halvedProgressIndex : s.progressIndex;
+					const int32_t buffs = (cond[l] == batchMalleable) * 4 + (muscleMemory[l] > 0) * 2 + (veneration[l] > 0);
+					const int32_t increased = progress[l] + progressTable[buffs * progressEfficiencies + index];
+
+					const int32_t success = succeeded[l];
+					const int32_t saved = success & (finalAppraisal[l] > 0) & (increased >= difficulty);
+					finalAppraisal[l] = saved ? 0 : finalAppraisal[l];
+					muscleMemory[l] = success ? 0 : muscleMemory[l];
+					progress[l] = success ? (saved ? difficulty - 1 : increased) : progress[l];
+				}
+			}
+
+			if (s.qualityIndex > 0 || s.qualityIndexPerInnerQuiet > 0)
+			{
+				int32_t* const greatStrides = timers[batchGreatStrides];
+				int32_t* const innovation = timers[batchInnovation];
+				for (int l = 0; l < lanes; ++l)
+				{
+					const int32_t index = s.qualityIndex + s.qualityIndexPerInnerQuiet * innerQuiet[l];
+					const int32_t conditionIndex = 1 - (cond[l] == batchPoor) + (cond[l] == batchGood) + (cond[l] == batchExcellent) * 2;
+					const int32_t buffs = conditionIndex * 4 + (greatStrides[l] > 0) * 2 + (innovation[l] > 0);
+					const int32_t increase = qualityTable[(buffs * (maxInnerQuiet + 1) + innerQuiet[l]) * qualityEfficiencies + index];
+
+					const int32_t success = succeeded[l];
+					quality[l] += success ? increase : 0;
+					greatStrides[l] = success ? 0 : greatStrides[l];
+					innerQuiet[l] += success & gainsInnerQuiet & (innerQuiet[l] < maxInnerQuiet);
+				}
+			}
+
+			// Everything else an action can do, in the same order as craft::performAction
+			if (s.addsRecipeQuality)
+				for (int l = 0; l < lanes; ++l)
+					quality[l] += succeeded[l] ? nominalQuality : 0;
+			if (s.innerQuietGained > 0)
+				for (int l = 0; l < lanes; ++l)
+				{
+					const int32_t gained = innerQuiet[l] + s.innerQuietGained;
+					innerQuiet[l] = succeeded[l] ? (gained < maxInnerQuiet ? gained : maxInnerQuiet) : innerQuiet[l];
+				}
+			if (s.buff >= 0)
+			{
+				int32_t* const buff = timers[s.buff];
+				const int32_t value = s.endsStep ? 0 : s.buffDuration;
+				for (int l = 0; l < lanes; ++l)
+					buff[l] = succeeded[l] ? value : buff[l];
+			}
+			if (s.durabilityCost > 0)
+			{
+				durabilityCosts(s.durabilityCost, wasteNot, wasteNot2, cond, cost);
+				for (int l = 0; l < lanes; ++l)
+					durability[l] -= acted[l] ? cost[l] : 0;
+			}
+			if (s.durabilityRestored > 0)
+				for (int l = 0; l < lanes; ++l)
+				{
+					const int32_t restored = durability[l] + s.durabilityRestored;
+					durability[l] = acted[l] ? (restored < maxDurability ? restored : maxDurability) : durability[l];
+				}
+			if (s.innerQuietAfter >= 0)
+				for (int l = 0; l < lanes; ++l)
+					innerQuiet[l] = acted[l] ? s.innerQuietAfter : innerQuiet[l];
+
+			if (!s.endsStep)
+			{
+				for (int l = 0; l < lanes; ++l)
+					softInvalid[l] += acted[l];	// see craft::performAll
+				continue;
+			}
+
+			// End the step for every lane the action went off in, unless that finished the craft
+			const int32_t remaining = in.length - 1 - k;
+			for (int l = 0; l < lanes; ++l)
+			{
+				const int32_t finished = acted[l] & ((durability[l] <= 0) | (progress[l] >= difficulty));
+				invalid[l] += finished * remaining;
+				live[l] &= finished ^ 1;
+				active[l] = acted[l] & (finished ^ 1);
+			}
+
+			for (int t = 0; t < batchTimers; ++t)
+				if (t != batchManipulation)
+					for (int l = 0; l < lanes; ++l)
+						timers[t][l] -= active[l];
+			{
+				int32_t* const manipulation = timers[batchManipulation];
+				for (int l = 0; l < lanes; ++l)
+				{
+					const int32_t manipulated = active[l] & (manipulation[l] > 0);
+					const int32_t restored = durability[l] + 5;
+					durability[l] = manipulated ? (restored < maxDurability ? restored : maxDurability) : durability[l];
+					manipulation[l] -= manipulated;
+				}
+			}
+
+			// Combos only last a step, except the one a successful action continues from
+			const bool keepsCombo = s.combo >= 0 && s.startsCombo >= 0;
+			if (keepsCombo)
+				for (int l = 0; l < lanes; ++l)
+					kept[l] = succeeded[l] & combo[l];
+			for (int c = 0; c < batchCombos; ++c)
+				for (int l = 0; l < lanes; ++l)
+					combos[c][l] = active[l] ? 0 : combos[c][l];
+			if (keepsCombo)
+				for (int l = 0; l < lanes; ++l)
+					combo[l] = active[l] ? kept[l] : combo[l];
+
+			if (!normalLock)
+			{
+				if (in.luck != nullptr) replayLanes(in, 1, step, roll);
+				else rollLanes(rng, roll);
+			}
+			for (int l = 0; l < lanes; ++l)
+			{
+				const int32_t current = cond[l];
+				int32_t next = normalLock ? static_cast<int32_t>(batchNormal) : conditionByRoll[roll[l]];
+				next = current == batchGoodOmen ? static_cast<int32_t>(batchGood) : next;
+				const int32_t settles = (expert ^ 1) & ((current == batchPoor) | (current == batchGood));
+				const int32_t turnsPoor = (expert ^ 1) & (current == batchExcellent);
+				next = settles ? static_cast<int32_t>(batchNormal) : (turnsPoor ? static_cast<int32_t>(batchPoor) : next);
+				cond[l] = active[l] ? next : current;
+				step[l] += active[l];
+				used[l] = active[l] & (normalLock ^ 1) & (current != batchGoodOmen) & ((settles | turnsPoor) ^ 1);
+			}
+			if (conditionRatios != nullptr)
+				for (int l = 0; l < lanes; ++l)
+					weight[l] *= used[l] ? conditionRatios[roll[l]] : 1.f;
+
+			// What a successful action does after the step ends (craft::performOnePost)
+			for (int l = 0; l < lanes; ++l)
+				active[l] &= succeeded[l];
+			if (s.buff >= 0 && s.endsStep)
+			{
+				int32_t* const buff = timers[s.buff];
+				for (int l = 0; l < lanes; ++l)
+					buff[l] = active[l] ? s.buffDuration + (cond[l] == batchPrimed) * 2 : buff[l];
+			}
+			if (s.buffCleared >= 0)
+			{
+				int32_t* const cleared = timers[s.buffCleared];
+				for (int l = 0; l < lanes; ++l)
+					cleared[l] = active[l] ? 0 : cleared[l];
+			}
+			if (s.startsCombo >= 0)
+			{
+				int32_t* const starts = combos[s.startsCombo];
+				for (int l = 0; l < lanes; ++l)
+				{
+					const int32_t continued = active[l] & (s.combo < 0 ? 1 : combo[l]);
+					starts[l] = continued ? 1 : starts[l];
+				}
+				if (s.combo >= 0)
+					for (int l = 0; l < lanes; ++l)
+						combo[l] = active[l] ? 0 : combo[l];
+			}
+
+			int32_t anyLive = 0;
+			for (int l = 0; l < lanes; ++l)
+				anyLive |= live[l];
+			if (!anyLive) break;
+		}
+
+		for (int l = 0; l < lanes; ++l)
+		{
+			out.progress[l] = progress[l];
+			out.quality[l] = quality[l];
+			out.steps[l] = step[l];
+			out.invalidActions[l] = invalid[l];
+			out.softInvalids[l] = softInvalid[l];
+			out.firstInvalid[l] = firstInvalid[l] != 0;
+			out.weight[l] = weight[l];
+		}
+	}
+}
@@ -65,6 +65,18 @@ actions cActionToATAction(int action)
 	else return it->first;
 }
 
+// The C API gets everything else about a recipe from the caller, so it works without the recipe table. Then only the
+// expert recipes the solver knew before the table had conditions get theirs, and every other recipe gets the normal ones
+int knownConditionsFlag(int rLevel)
+{
+	switch (rLevel)
+	{
+	case 513: return 0x1E3;	// normal, good, sturdy, pliant, malleable, primed
+	case 611: return 0x1B3;	// normal, good, centered, sturdy, malleable, primed
+	default: return 0;
+	}
+}
+
 atSolver* atInitSolver(atCrafter crafter, atRecipe recipe, int* initialSequence, int initialSequenceSize, int cGoal, int initialQuality, int threads, int normalLock, int cStrat, int population, int useConditionals, double selectionPressure)
 {
 	craft::sequenceType seed;
@@ -88,6 +100,8 @@ atSolver* atInitSolver(atCrafter crafter, atRecipe recipe, int* initialSequence,
 	rec.durability = recipe.durability;
 	rec.progressFactor = recipe.progressFactor;
 	rec.qualityFactor = recipe.qualityFactor;
+	rec.conditionsFlag = recipeTableLoaded() ? getConditionsFlag(recipe.rLevel) : knownConditionsFlag(recipe.rLevel);
+	rec.expert = (rec.conditionsFlag & ~0x0F) != 0;	// any of the expert-only conditions
 
 	for (unsigned int i = 0; i + 1 < recipe.pointsSize; i += 2)
 		rec.points.emplace_back(recipe.points[i], recipe.points[i + 1]);
@@ -141,7 +155,7 @@ int atLoadRecipeTable(const char* filename)
 
 atSolverCallback cCallback;
 
-bool cSolverCallback(int generations, int currentGeneration, int simsPerTrial, goalType goal, strategy strat, solver::trial status, int uniquePopulation, int cacheHits)
+bool cSolverCallback(int generations, int currentGeneration, int simsPerTrial, goalType goal, strategy strat, solver::trial status, int uniquePopulation, int cacheHits, int simsSaved, int copySims)
 {
 	if (!cCallback) return true;
 
@@ -150,6 +164,8 @@ bool cSolverCallback(int generations, int currentGeneration, int simsPerTrial, g
 	(void)strat;
 	(void)uniquePopulation;
 	(void)cacheHits;
+	(void)simsSaved;
+	(void)copySims;
 
 	atSolverResult result;
 
@@ -204,6 +220,97 @@ atSolverResult atExecuteSimulations(atSolver* cSolver, int numberOfSimulations)
 	return result;
 }
 
+void atSetPriority(atSolver* cSolver, int priority)
+{
+	reinterpret_cast<solver*>(cSolver)->setPriority(priority);
+}
+
+void atSetSampling(atSolver* cSolver, int sampling)
+{
+	solver* solve = reinterpret_cast<solver*>(cSolver);
+
+	switch (sampling)
+	{
+	case AT_SAMPLING_ANTITHETIC:
+		solve->setSampling(samplingMethod::antithetic);
+		break;
+	case AT_SAMPLING_STRATIFIED:
+		solve->setSampling(samplingMethod::stratified);
+		break;
+	case AT_SAMPLING_IMPORTANCE:
+		solve->setSampling(samplingMethod::importance);
+		break;
+	default:
+		solve->setSampling(samplingMethod::random);
+		break;
+	}
+}
+
+int atSetCacheFile(atSolver* cSolver, const char* filename, int maxCacheSize)
+{
+	return reinterpret_cast<solver*>(cSolver)->setCacheFile(filename, maxCacheSize) ? 0 : 1;
+}
+
+void atSetVerification(atSolver* cSolver, int candidates, int simulations)
+{
+	reinterpret_cast<solver*>(cSolver)->setVerification(candidates, simulations);
+}
+
+atStandardErrors atGetStandardErrors(atSolver* cSolver)
+{
+	const solver::standardErrors& errors = reinterpret_cast<solver*>(cSolver)->getStandardErrors();
+
+	atStandardErrors result;
+	result.successRate = errors.successes;
+	result.goal = errors.goal;
+	return result;
+}
+
+atFailureEstimate atGetFailureEstimate(atSolver* cSolver)
+{
+	const solver::failureEstimate& failures = reinterpret_cast<solver*>(cSolver)->getFailureEstimate();
+
+	atFailureEstimate result;
+	result.rate = failures.rate;
+	result.standardError = failures.standardError;
+	return result;
+}
+
+int atGetVerifiedCount(atSolver* cSolver)
+{
+	return static_cast<int>(reinterpret_cast<solver*>(cSolver)->getVerified().size());
+}
+
+atVerifiedCandidate atGetVerified(atSolver* cSolver, int index)
+{
+	solver* solve = reinterpret_cast<solver*>(cSolver);
+	const solver::verifiedCandidate& verified = solve->getVerified().at(static_cast<size_t>(index));
+
+	atVerifiedCandidate result;
+	populateResultSequence(&result.result, verified.candidate.sequence);
+
+	result.result.successes = verified.candidate.outcome.successes;
+	switch (solve->getGoal())
+	{
+	case goalType::hq:
+		result.result.hqPercent = verified.candidate.outcome.hqPercent;
+		break;
+	case goalType::maxQuality:
+		result.result.quality = verified.candidate.outcome.quality;
+		break;
+	case goalType::collectability:
+		result.result.collectableHit = verified.candidate.outcome.collectableGoalsHit;
+		break;
+	case goalType::points:
+		result.result.points = verified.candidate.outcome.points;
+		break;
+	}
+	result.simulations = verified.candidate.outcome.simulations;
+	result.errors.successRate = verified.errors.successes;
+	result.errors.goal = verified.errors.goal;
+	return result;
+}
+
 atSolverResult atExecuteSolve(atSolver* cSolver, int simulationsPerSequence, int generations, int maxCacheSize, atSolverCallback callback)
 {
 	solver* solve = reinterpret_cast<solver*>(cSolver);
@@ -25,6 +25,7 @@ struct recipeStats
 	int qualityFactor;
 	int progressPenalty;	// applied when clvl < rlvl
 	int qualityPenalty;
+	int conditionsFlag;	// which conditions can occur, as RecipeLevelTable's ConditionsFlag. 0 if unknown
 
 	std::vector<std::pair<int, int>> points;	// must be in order low to high
 	
@@ -38,6 +39,14 @@ enum class strategy
 	nqOnly		// Maximize only success rate
 };
 
+enum class samplingMethod
+{
+	random,		// Independent sims
+	antithetic,	// Sims in pairs, the second with every success roll mirrored
+	stratified,	// Each step's rolls spread evenly over the sims
+	importance	// Sims pushed toward failing, weighted back to estimate the failure rate
+};
+
 enum class goalType
 {
 	hq,				// Maximize average HQ%
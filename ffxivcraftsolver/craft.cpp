@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <iostream>
 #include <map>
+#include <array>
 #include <cmath>
 #include "craft.h"
 #include "levels.h"
@@ -10,9 +11,9 @@ using namespace std;
 using actionResult = craft::actionResult;
 
 // chance == 70 means 70% success and so on
-inline bool craft::rollPercent(int chance) const
+inline bool craft::rollPercent(int chance)
 {
-	if (cond == condition::centered) chance += 25;
+	if (current.cond == condition::centered) chance += 25;
 
 	if (chance >= 100) return true;
 
@@ -23,64 +24,49 @@ inline bool craft::rollPercent(int chance) const
 	case rngOverride::failure:
 		return false;
 	case rngOverride::random:
+		if (luck != nullptr)
+		{
+			const int roll = luck->roll(tape, current.step, luckTapes::successRoll);
+			luckWeight *= luck->ratio(luckTapes::successRoll, roll);
+			return roll < chance;
+		}
 		assert(rng != nullptr);
 		return rng->generateInt(99) < chance;
 	}
 }
 
-void craft::increaseProgress(int efficiency)
+int craft::context::calculateProgressIncrease(int efficiency, bool malleable, bool muscleMemory, bool veneration) const
 {
 	float bonus = 1.f;
 
-	if (muscleMemoryTime > 0)
+	if (muscleMemory)
 	{
 		bonus += 1.f;
-		muscleMemoryTime = 0;
 	}
 
-	if (venerationTime > 0)
+	if (veneration)
 	{
 		bonus += 0.5f;
 	}
 
 	float baseProgress = (crafter.craftsmanship * 10.f) / recipe.progressFactor + 2.f;
 	float levelMod = crafter.cLevel <= recipe.rLevel ? recipe.progressPenalty * 0.01f : 1.f;
-	float conditionMod;
-
-	switch (cond)
-	{
-	case condition::malleable:
-		conditionMod = 1.5f;
-		break;
-	case condition::normal:
-	default:
-		conditionMod = 1.0f;
-		break;
-	}
+	float conditionMod = malleable ? 1.5f : 1.0f;
 
 	int progressIncrease = static_cast<int>(baseProgress * levelMod);
-	progress += static_cast<int>((progressIncrease * conditionMod * bonus * efficiency) / 100);
-
-	if (finalAppraisalTime > 0 && progress >= recipe.difficulty)
-	{
-		progress = recipe.difficulty - 1;
-		finalAppraisalTime = 0;
-	}
-
-	return;
+	return static_cast<int>((progressIncrease * conditionMod * bonus * efficiency) / 100);
 }
 
-void craft::increaseQuality(int efficiency)
+int craft::context::calculateQualityIncrease(int efficiency, condition cond, bool greatStrides, bool innovation, int innerQuiet) const
 {
 	double bonus = 1.f;
 
-	if (greatStridesTime > 0)
+	if (greatStrides)
 	{
 		bonus += 1.f;
-		greatStridesTime = 0;
 	}
 
-	if (innovationTime > 0)
+	if (innovation)
 	{
 		bonus += 0.5f;
 	}
@@ -115,9 +101,74 @@ void craft::increaseQuality(int efficiency)
 	float q2 = q1 * bonus;
 	float q3 = q2 * efficiency;
 	//quality += static_cast<int>((qualityIncrease * conditionMod * bonus * efficiency) / 100);
-	quality += static_cast<int>((q3) / 100);
+	return static_cast<int>((q3) / 100);
+}
+
+void craft::context::buildTables()
+{
+	progressIncreases.clear();
+	progressIncreases.reserve(8 * progressEfficiencies);
+	for (bool malleable : { false, true })
+		for (bool muscleMemory : { false, true })
+			for (bool veneration : { false, true })
+				for (size_t e = 0; e < progressEfficiencies; ++e)
+					progressIncreases.push_back(calculateProgressIncrease(static_cast<int>(e) * progressEfficiencyStep, malleable, muscleMemory, veneration));
+
+	// Same order as qualityConditionIndex
+	const condition qualityConditions[] = { condition::poor, condition::normal, condition::good, condition::excellent };
+
+	qualityIncreases.clear();
+	qualityIncreases.reserve(16 * (maxInnerQuiet + 1) * qualityEfficiencies);
+	for (condition cond : qualityConditions)
+		for (bool greatStrides : { false, true })
+			for (bool innovation : { false, true })
+				for (int innerQuiet = 0; innerQuiet <= maxInnerQuiet; ++innerQuiet)
+					for (size_t e = 0; e < qualityEfficiencies; ++e)
+						qualityIncreases.push_back(calculateQualityIncrease(static_cast<int>(e) * qualityEfficiencyStep, cond, greatStrides, innovation, innerQuiet));
+
+	pointsByCollectability.clear();
+	if (!recipe.points.empty())
+	{
+		int highest = 0;
+		for (const auto& p : recipe.points)
+			highest = max(highest, p.first);
+		pointsByCollectability.resize(static_cast<size_t>(max(highest, 0)) + 1, 0);
+		for (size_t collectability = 0; collectability < pointsByCollectability.size(); ++collectability)
+		{
+			// points is ordered by value, not collectability, so this has to match the old linear scan exactly
+			for (const auto& p : recipe.points)
+				if (static_cast<int>(collectability) >= p.first)
+					pointsByCollectability[collectability] = p.second;
+		}
+	}
+}
 
-	if (crafter.level >= 11 && innerQuiet < 10) innerQuiet++;
+void craft::increaseProgress(int efficiency)
+{
+	current.progress += ctx->progressIncrease(efficiency, current.cond == condition::malleable,
+		current.muscleMemoryTime > 0, current.venerationTime > 0);
+
+	if (current.muscleMemoryTime > 0)
+		current.muscleMemoryTime = 0;
+
+	if (current.finalAppraisalTime > 0 && current.progress >= ctx->recipe.difficulty)
+	{
+		current.progress = ctx->recipe.difficulty - 1;
+		current.finalAppraisalTime = 0;
+	}
+
+	return;
+}
+
+void craft::increaseQuality(int efficiency)
+{
+	current.quality += ctx->qualityIncrease(efficiency, current.cond,
+		current.greatStridesTime > 0, current.innovationTime > 0, current.innerQuiet);
+
+	if (current.greatStridesTime > 0)
+		current.greatStridesTime = 0;
+
+	if (ctx->crafter.level >= 11 && current.innerQuiet < 10) current.innerQuiet++;
 
 	return;
 }
@@ -127,15 +178,15 @@ bool craft::changeCP(int amount)
 {
 	if (amount >= 0)
 	{
-		CP = min(CP + amount, crafter.CP);
+		current.CP = min(current.CP + amount, ctx->crafter.CP);
 		return true;
 	}
 
-	if (cond == condition::pliant) amount -= amount / 2;
+	if (current.cond == condition::pliant) amount -= amount / 2;
 
-	if (-amount > CP) return false;
+	if (-amount > current.CP) return false;
 
-	CP += amount;
+	current.CP += amount;
 	return true;
 }
 
@@ -144,36 +195,81 @@ bool inRange(int num, int high, int low)
 	return low <= num && num <= high;
 }
 
-void craft::setProbabilities()
+craft::context::context(const crafterStats& cS, const recipeStats& rS, bool nLock) :
+	crafter(cS),
+	recipe(rS),
+	normalLock(nLock)
+{
+	setProbabilities();
+	buildTables();
+	resolveActions();
+}
+
+uint64_t craft::context::fingerprint() const
+{
+	// The stats the tables were built from, rather than the tables themselves
+	uint64_t output = 0;
+	auto fold = [&output](int value) { output = splitmix64(output ^ static_cast<uint32_t>(value))(); };
+	fold(crafter.level);
+	fold(crafter.cLevel);
+	fold(crafter.craftsmanship);
+	fold(crafter.control);
+	fold(crafter.CP);
+	fold(crafter.good75);
+	fold(recipe.rLevel);
+	fold(recipe.difficulty);
+	fold(recipe.quality);
+	fold(recipe.nominalQuality);
+	fold(recipe.durability);
+	fold(recipe.progressFactor);
+	fold(recipe.qualityFactor);
+	fold(recipe.progressPenalty);
+	fold(recipe.qualityPenalty);
+	fold(recipe.conditionsFlag);
+	for (const auto& p : recipe.points)
+	{
+		fold(p.first);
+		fold(p.second);
+	}
+	fold(static_cast<int>(recipe.points.size()));
+	fold(recipe.expert);
+	fold(normalLock);
+	return output;
+}
+
+// Bit positions in RecipeLevelTable.csv's ConditionsFlag column
+int conditionFlagBit(craft::condition cond)
 {
-	conditionChances.clear();
-	if (recipe.expert)
+	switch (cond)
 	{
-		if (recipe.rLevel == 611)
-		{
-			conditionChances.insert({ condition::good, 12 });
-			conditionChances.insert({ condition::centered, 15 });
-			conditionChances.insert({ condition::sturdy, 15 });
-			conditionChances.insert({ condition::malleable, 12 });
-			conditionChances.insert({ condition::primed, 12 });
-		}
-		else if (recipe.rLevel == 513)
-		{
-			conditionChances.insert({ condition::good, 12 });
-			conditionChances.insert({ condition::sturdy, 15 });
-			conditionChances.insert({ condition::pliant, 12 });
-			conditionChances.insert({ condition::malleable, 12 });
-			conditionChances.insert({ condition::primed, 12 });
-		}
-		else
-		{
-			conditionChances.insert({ condition::good, 12 });
-			conditionChances.insert({ condition::centered, 15 });
-			conditionChances.insert({ condition::sturdy, 15 });
-			conditionChances.insert({ condition::pliant, 12 });
-		}
+	case craft::condition::normal: return 0;
+	case craft::condition::good: return 1;
+	case craft::condition::excellent: return 2;
+	case craft::condition::poor: return 3;
+	case craft::condition::centered: return 4;
+	case craft::condition::sturdy: return 5;
+	case craft::condition::pliant: return 6;
+	case craft::condition::malleable: return 7;
+	case craft::condition::primed: return 8;
+	case craft::condition::goodomen: return 9;
 	}
-	else
+	assert(false);
+	return 0;
+}
+
+// Used if the recipe table didn't provide a flag
+constexpr int defaultConditionsFlag = 0x0F;			// normal, good, excellent, poor
+constexpr int defaultExpertConditionsFlag = 0x73;	// normal, good, centered, sturdy, pliant
+
+void craft::context::setProbabilities()
+{
+	int flags = recipe.conditionsFlag;
+	if (flags == 0) flags = recipe.expert ? defaultExpertConditionsFlag : defaultConditionsFlag;
+
+	int goodChance = 12;
+	int excellentChance = 0;
+
+	if (!recipe.expert)
 	{
 		bool qualityAssurance = crafter.level >= 63;
 
@@ -184,8 +280,8 @@ void craft::setProbabilities()
 			recipe.rLevel >= 570				// 90*+
 			)
 		{
-			conditionChances.insert({ condition::good, qualityAssurance ? 11 : 10 });
-			conditionChances.insert({ condition::excellent, 1 });
+			goodChance = qualityAssurance ? 11 : 10;
+			excellentChance = 1;
 		}
 		else if (
 			inRange(recipe.rLevel, 136, 159) ||	// 55+
@@ -194,8 +290,8 @@ void craft::setProbabilities()
 			inRange(recipe.rLevel, 535, 569)	// 85+
 			)
 		{
-			conditionChances.insert({ condition::good, qualityAssurance ? 17 : 15 });
-			conditionChances.insert({ condition::excellent, 2 });
+			goodChance = qualityAssurance ? 17 : 15;
+			excellentChance = 2;
 		}
 		else if (
 			inRange(recipe.rLevel, 115, 135) ||	// 51+	
@@ -204,23 +300,45 @@ void craft::setProbabilities()
 			inRange(recipe.rLevel, 518, 534)	// 81+
 			)
 		{
-			conditionChances.insert({ condition::good, qualityAssurance ? 22 : 20 });
-			conditionChances.insert({ condition::excellent, 2 });
+			goodChance = qualityAssurance ? 22 : 20;
+			excellentChance = 2;
 		}
 		else									// 1+
 		{
-			conditionChances.insert({ condition::good, qualityAssurance ? 27 : 25 });
-			conditionChances.insert({ condition::excellent, 2 });
+			goodChance = qualityAssurance ? 27 : 25;
+			excellentChance = 2;
 		}
 	}
+
+	// Each entry as integer percentage, in the order rolls are assigned. Normal takes whatever is left over.
+	// Poor is never rolled; it only follows excellent.
+	const pair<condition, int> conditionChances[] = {
+		{ condition::good, goodChance },
+		{ condition::excellent, excellentChance },
+		{ condition::centered, 15 },
+		{ condition::sturdy, 15 },
+		{ condition::pliant, 12 },
+		{ condition::malleable, 12 },
+		{ condition::primed, 12 },
+		{ condition::goodomen, 10 }
+	};
+
+	conditionByRoll.fill(condition::normal);
+	size_t roll = 0;
+	for (const auto& c : conditionChances)
+	{
+		if ((flags & (1 << conditionFlagBit(c.first))) == 0) continue;
+		for (int i = 0; i < c.second && roll < conditionByRoll.size(); ++i)
+			conditionByRoll[roll++] = c.first;
+	}
 }
 
-craft::condition craft::getNextCondition(condition current)
+craft::condition craft::getNextCondition(condition currentCondition)
 {
-	// Unfortunately, std::discrete_distribution is far too slow to be usable.
-	if (!recipe.expert)
+	// Unfortunately, std::discrete_distribution is far too slow to be usable, hence conditionByRoll.
+	if (!ctx->recipe.expert)
 	{
-		switch (current)
+		switch (currentCondition)
 		{
 		case condition::poor:
 		case condition::good:
@@ -233,67 +351,73 @@ craft::condition craft::getNextCondition(condition current)
 		}
 	}
 
-	if (current == condition::goodomen) return condition::good;
+	if (currentCondition == condition::goodomen) return condition::good;
 
-	if (normalLock || over != rngOverride::random) return condition::normal;
+	if (ctx->normalLock) return condition::normal;
+	if (over != rngOverride::random) return forcedCondition;
 
-	int roll = rng->generateInt(99);
-	
-	for (const auto& c : conditionChances)
+	static_assert(std::tuple_size<decltype(ctx->conditionByRoll)>::value == 100, "luck tapes roll conditions out of 100");
+	if (luck != nullptr)
 	{
-		if (roll < c.second) return c.first;
-		else roll -= c.second;
+		const int roll = luck->roll(tape, current.step, luckTapes::conditionRoll);
+		luckWeight *= luck->ratio(luckTapes::conditionRoll, roll);
+		return ctx->conditionByRoll[roll];
 	}
-
-	return condition::normal;
+	return ctx->conditionByRoll[rng->generateInt(ctx->conditionByRoll.size() - 1)];
 }
 
 void craft::endStep(actions action, actionResult result)
 {
-	muscleMemoryTime--;
-	wasteNotTime--;
-	wasteNot2Time--;
-	if(manipulationTime > 0)
+	current.muscleMemoryTime--;
+	current.wasteNotTime--;
+	current.wasteNot2Time--;
+	if(current.manipulationTime > 0)
 	{
 		raiseDurability(5);
-		manipulationTime--;
+		current.manipulationTime--;
 	}
-	greatStridesTime--;
-	venerationTime--;
-	innovationTime--;
-	finalAppraisalTime--;
-	observeCombo = false;
-	// Not the prettiest, but it'll do
-	if(action != actions::standardTouch || result != actionResult::success)
-		basicTouchCombo = false;
-	standardTouchCombo = false;
-	cond = getNextCondition(cond);
-
-	step++;
+	current.greatStridesTime--;
+	current.venerationTime--;
+	current.innovationTime--;
+	current.finalAppraisalTime--;
+	// Combos only last a step, except the one a successful action continues from, which performOnePost moves along
+	const actionDescriptor& d = ctx->actionTable[static_cast<size_t>(action)];
+	bool state::* kept = (result == actionResult::success && d.startsCombo != nullptr) ? d.combo : nullptr;
+	const bool keepKept = kept != nullptr && current.*kept;
+	current.basicTouchCombo = false;
+	current.standardTouchCombo = false;
+	current.observeCombo = false;
+	if (keepKept) current.*kept = true;
+	current.cond = getNextCondition(current.cond);
+
+	current.step++;
 
 	return;
 }
 
-const map<int, int> qualityPercentToHQPercent = {
-	{0, 1}, {5, 2}, {9, 3}, {13, 4}, {17, 5}, {21, 6}, {25, 7}, {29, 8},
-	{32, 9}, {35, 10}, {38, 11}, {41, 12}, {44, 13}, {47, 14}, {50, 15}, {53, 16},
-	{55, 17}, {58, 18}, {61, 19}, {63, 20}, {65, 21}, {66, 22}, {67, 23}, {68, 24},
-	{69, 26}, {70, 28}, {71, 31}, {72, 34}, {73, 38}, {74, 42}, {75, 47}, {76, 52},
-	{77, 58}, {78, 64}, {79, 68}, {80, 71}, {81, 74}, {82, 76}, {83, 78}, {84, 80},
-	{85, 81}, {86, 82}, {87, 83}, {88, 84}, {89, 85}, {90, 86}, {91, 87}, {92, 88},
-	{93, 89}, {94, 90}, {95, 91}, {96, 92}, {97, 94}, {98, 96}, {99, 98}, {100, 100}
+// index is the quality percentage
+const array<int, 101> qualityPercentToHQPercent = {
+	1, 1, 1, 1, 1, 2, 2, 2, 2, 3,	// 0-9%
+	3, 3, 3, 4, 4, 4, 4, 5, 5, 5,	// 10-19%
+	5, 6, 6, 6, 6, 7, 7, 7, 7, 8,	// 20-29%
+	8, 8, 9, 9, 9, 10, 10, 10, 11, 11,	// 30-39%
+	11, 12, 12, 12, 13, 13, 13, 14, 14, 14,	// 40-49%
+	15, 15, 15, 16, 16, 17, 17, 17, 18, 18,	// 50-59%
+	18, 19, 19, 20, 20, 21, 22, 23, 24, 26,	// 60-69%
+	28, 31, 34, 38, 42, 47, 52, 58, 64, 68,	// 70-79%
+	71, 74, 76, 78, 80, 81, 82, 83, 84, 85,	// 80-89%
+	86, 87, 88, 89, 90, 91, 92, 94, 96, 98,	// 90-99%
+	100											// 100%
 };
 
 int craft::hqPercentFromQuality(int qualityPercent)
 {
-	auto it = qualityPercentToHQPercent.upper_bound(qualityPercent);
-	if (it == qualityPercentToHQPercent.cbegin())
+	if (qualityPercent < 0)
 	{
 		assert(false);
 		return 1;
 	}
-	--it;
-	return it->second;
+	return qualityPercentToHQPercent[min(static_cast<size_t>(qualityPercent), qualityPercentToHQPercent.size() - 1)];
 }
 
 string stateBuffList(const string& name, int variable, bool* anybuffs)
@@ -306,16 +430,16 @@ string stateBuffList(const string& name, int variable, bool* anybuffs)
 string craft::getState() const
 {
 	string output;
-	output += "Progress: " + to_string(progress) + '/' + to_string(recipe.difficulty);
-	output += ", Quality: " + to_string(quality);
-	if(recipe.quality > 0) output += '/' + to_string(recipe.nominalQuality);
-	output += ", Durability: " + to_string(durability) + '/' + to_string(recipe.durability);
-	output += ", CP: " + to_string(CP) + '/' + to_string(crafter.CP) + '\n';
+	output += "Progress: " + to_string(current.progress) + '/' + to_string(ctx->recipe.difficulty);
+	output += ", Quality: " + to_string(current.quality);
+	if(ctx->recipe.quality > 0) output += '/' + to_string(ctx->recipe.nominalQuality);
+	output += ", Durability: " + to_string(current.durability) + '/' + to_string(ctx->recipe.durability);
+	output += ", CP: " + to_string(current.CP) + '/' + to_string(ctx->crafter.CP) + '\n';
 
-	if (!normalLock)
+	if (!ctx->normalLock)
 	{
 		output += "Condition: ";
-		switch (cond)
+		switch (current.cond)
 		{
 		case condition::poor:
 			output += "Poor, ";
@@ -350,26 +474,26 @@ string craft::getState() const
 
 	output += "Buffs: ";
 	bool anybuffs = false;
-	output += stateBuffList("Muscle Memory: ", muscleMemoryTime, &anybuffs);
-	output += stateBuffList("Waste Not: ", wasteNotTime, &anybuffs);
-	output += stateBuffList("Waste Not 2: ", wasteNot2Time, &anybuffs);
-	output += stateBuffList("Manipulation: ", manipulationTime, &anybuffs);
-	output += stateBuffList("Inner Quiet: ", innerQuiet, &anybuffs);
-	output += stateBuffList("Great Strides: ", greatStridesTime, &anybuffs);
-	output += stateBuffList("Veneration: ", venerationTime, &anybuffs);
-	output += stateBuffList("Innovation: ", innovationTime, &anybuffs);
-	output += stateBuffList("Final Appraisal: ", finalAppraisalTime, &anybuffs);
-	if (basicTouchCombo)
+	output += stateBuffList("Muscle Memory: ", current.muscleMemoryTime, &anybuffs);
+	output += stateBuffList("Waste Not: ", current.wasteNotTime, &anybuffs);
+	output += stateBuffList("Waste Not 2: ", current.wasteNot2Time, &anybuffs);
+	output += stateBuffList("Manipulation: ", current.manipulationTime, &anybuffs);
+	output += stateBuffList("Inner Quiet: ", current.innerQuiet, &anybuffs);
+	output += stateBuffList("Great Strides: ", current.greatStridesTime, &anybuffs);
+	output += stateBuffList("Veneration: ", current.venerationTime, &anybuffs);
+	output += stateBuffList("Innovation: ", current.innovationTime, &anybuffs);
+	output += stateBuffList("Final Appraisal: ", current.finalAppraisalTime, &anybuffs);
+	if (current.basicTouchCombo)
 	{
 		anybuffs = true;
 		output += "Basic Touch; ";
 	}
-	if (standardTouchCombo)
+	if (current.standardTouchCombo)
 	{
 		anybuffs = true;
 		output += "Standard Touch; ";
 	}
-	if (observeCombo)
+	if (current.observeCombo)
 	{
 		anybuffs = true;
 		output += "Observe; ";
@@ -384,398 +508,350 @@ string craft::getState() const
 	return output;
 }
 
-actionResult craft::commonSynth(int cpChange, int efficiency, int successChance, int durabilityCost)
+namespace
 {
-	if (!changeCP(cpChange)) return actionResult::failNoCP;
-	actionResult output;
-
-	if (rollPercent(successChance))
+	// Builds an actionDescriptor one property at a time, so the table below reads as a list of what's special about each action
+	class describe
 	{
-		increaseProgress(efficiency);
-		output = actionResult::success;
-	}
-	else output = actionResult::failRNG;
-
-	lowerDurability(durabilityCost);
-
-	return output;
-}
-
-actionResult craft::commonTouch(int cpChange, int efficiency, int successChance, int durabilityCost)
-{
-	if (!changeCP(cpChange)) return actionResult::failNoCP;
-	actionResult output;
-
-	if (rollPercent(successChance))
+		craft::actionDescriptor d;
+	public:
+		constexpr explicit describe(actions a) : d() { d.action = a; }
+		constexpr operator craft::actionDescriptor() const { return d; }
+
+		constexpr describe cost(int cp) const { describe o = *this; o.d.CPCost = cp; return o; }
+		constexpr describe progress(int efficiency) const { describe o = *this; o.d.progressEfficiency = efficiency; return o; }
+		constexpr describe quality(int efficiency) const { describe o = *this; o.d.qualityEfficiency = efficiency; return o; }
+		constexpr describe chance(int percent) const { describe o = *this; o.d.successChance = percent; return o; }
+		constexpr describe durability(int cost) const { describe o = *this; o.d.durabilityCost = cost; return o; }
+		constexpr describe restores(int durability) const { describe o = *this; o.d.durabilityRestored = durability; return o; }
+		constexpr describe upgrade(int level, int efficiency) const
+		{
+			describe o = *this;
+			o.d.upgradeLevel = level;
+			o.d.upgradedProgressEfficiency = efficiency;
+			return o;
+		}
+		constexpr describe combo(bool craft::state::* c, int cp, int percent) const
+		{
+			describe o = *this;
+			o.d.combo = c;
+			o.d.comboCPCost = cp;
+			o.d.comboSuccessChance = percent;
+			return o;
+		}
+		constexpr describe starts(bool craft::state::* c) const { describe o = *this; o.d.startsCombo = c; return o; }
+		constexpr describe buff(short craft::state::* b, short duration) const
+		{
+			describe o = *this;
+			o.d.buff = b;
+			o.d.buffDuration = duration;
+			return o;
+		}
+		constexpr describe clears(short craft::state::* b) const { describe o = *this; o.d.buffCleared = b; return o; }
+		constexpr describe firstStep() const { describe o = *this; o.d.firstStepOnly = true; return o; }
+		constexpr describe noWasteNot() const { describe o = *this; o.d.blockedByWasteNot = true; return o; }
+		constexpr describe needsGood() const { describe o = *this; o.d.needsGoodCondition = true; return o; }
+		constexpr describe minimumIQ(int stacks) const { describe o = *this; o.d.minimumInnerQuiet = stacks; return o; }
+		constexpr describe lowerLevelRecipe() const { describe o = *this; o.d.needsLowerLevelRecipe = true; return o; }
+		constexpr describe perIQ(int efficiency) const { describe o = *this; o.d.qualityPerInnerQuiet = efficiency; return o; }
+		constexpr describe gainsIQ(int stacks) const { describe o = *this; o.d.innerQuietGained = stacks; return o; }
+		constexpr describe setsIQ(int stacks) const { describe o = *this; o.d.innerQuietAfter = stacks; return o; }
+		constexpr describe recipeQuality() const { describe o = *this; o.d.addsRecipeQuality = true; return o; }
+		constexpr describe halvedWithoutDurability() const { describe o = *this; o.d.halvedWithoutDurability = true; return o; }
+		constexpr describe instant() const { describe o = *this; o.d.endsStep = false; return o; }
+		constexpr describe unavailable() const { describe o = *this; o.d.available = false; return o; }
+	};
+
+	using st = craft::state;
+
+	// Indexed by actions, so this has to stay in the same order as the enum
+	constexpr craft::actionDescriptor actionDescriptors[] = {
+		describe(actions::basicSynth).progress(100).durability(10).upgrade(31, 120),
+		describe(actions::carefulSynthesis).cost(7).progress(150).durability(10).upgrade(82, 180),
+		describe(actions::rapidSynthesis).progress(250).chance(50).durability(10).upgrade(63, 500),
+		describe(actions::focusedSynthesis).cost(5).progress(200).chance(50).durability(10).combo(&st::observeCombo, 5, 100),
+		describe(actions::groundwork).cost(18).progress(300).durability(20).upgrade(86, 360).halvedWithoutDurability(),
+		describe(actions::delicateSynthesis).cost(32).progress(100).quality(100).durability(10),
+		describe(actions::prudentSynthesis).cost(18).progress(180).durability(5).noWasteNot(),
+		describe(actions::intensiveSynthesis).cost(6).progress(400).durability(10).needsGood(),
+		describe(actions::muscleMemory).cost(6).progress(300).durability(10).firstStep().buff(&st::muscleMemoryTime, 5),
+
+		describe(actions::basicTouch).cost(18).quality(100).durability(10).starts(&st::basicTouchCombo),
+		describe(actions::standardTouch).cost(32).quality(125).durability(10).combo(&st::basicTouchCombo, 18, 100).starts(&st::standardTouchCombo),
+		describe(actions::advancedTouch).cost(46).quality(150).durability(10).combo(&st::standardTouchCombo, 18, 100),
+		describe(actions::hastyTouch).quality(100).chance(60).durability(10),
+		describe(actions::byregotsBlessing).cost(24).quality(100).durability(10).minimumIQ(1).perIQ(20).setsIQ(0),
+		describe(actions::preciseTouch).cost(18).quality(150).durability(10).needsGood().gainsIQ(1),
+		describe(actions::focusedTouch).cost(18).quality(150).chance(50).durability(10).combo(&st::observeCombo, 18, 100),
+		describe(actions::prudentTouch).cost(25).quality(100).durability(5).noWasteNot(),
+		describe(actions::preparatoryTouch).cost(40).quality(200).durability(20).gainsIQ(1),
+		describe(actions::trainedEye).cost(250).firstStep().lowerLevelRecipe().recipeQuality().setsIQ(1),
+		describe(actions::trainedFinesse).cost(32).quality(100).minimumIQ(10),
+
+		describe(actions::tricksOfTheTrade).cost(-20).needsGood(),
+
+		describe(actions::mastersMend).cost(88).restores(30),
+		describe(actions::wasteNot).cost(56).buff(&st::wasteNotTime, 4).clears(&st::wasteNot2Time),
+		describe(actions::wasteNot2).cost(98).buff(&st::wasteNot2Time, 8).clears(&st::wasteNotTime),
+		describe(actions::manipulation).cost(96).buff(&st::manipulationTime, 8),
+
+		describe(actions::innerQuiet).unavailable(),	// only there for setBuff
+		describe(actions::reflect).cost(6).quality(100).durability(10).firstStep().gainsIQ(1),
+		describe(actions::greatStrides).cost(32).buff(&st::greatStridesTime, 3),
+		describe(actions::veneration).cost(18).buff(&st::venerationTime, 4),
+		describe(actions::innovation).cost(18).buff(&st::innovationTime, 4),
+		describe(actions::finalAppraisal).cost(1).buff(&st::finalAppraisalTime, 5).instant(),
+
+		describe(actions::observe).cost(7).starts(&st::observeCombo)
+	};
+
+	constexpr bool descriptorsInOrder(size_t i = 0)
 	{
-		increaseQuality(efficiency);
-		output = actionResult::success;
+		return i == sizeof(actionDescriptors) / sizeof(actionDescriptors[0]) ||
+			(actionDescriptors[i].action == static_cast<actions>(i) && descriptorsInOrder(i + 1));
 	}
-	else output = actionResult::failRNG;
-
-	lowerDurability(durabilityCost);
 
-	return output;
-}
-
-/***
-SYNTHESIS ACTIONS
-***/
-
-actionResult craft::delicateSynthesis()
-{
-	if (!changeCP(-32)) return actionResult::failNoCP;
-	
-	increaseProgress(100);
-	increaseQuality(100);
-
-	lowerDurability();
-	return actionResult::success;
+	static_assert(sizeof(actionDescriptors) / sizeof(actionDescriptors[0]) == static_cast<size_t>(actions::invalid), "every action needs a descriptor");
+	static_assert(descriptorsInOrder(), "actionDescriptors must be in the same order as actions");
 }
 
-actionResult craft::groundwork()
+void craft::context::resolveActions()
 {
-	int efficiency = crafter.level >= 86 ? 360 : 300;
-	if (durability < getDurabilityCost(20)) efficiency /= 2;
-	return commonSynth(-18, efficiency, 100, 20);
-}
-
-actionResult craft::prudentSynthesis()
-{
-	if (wasteNotTime > 0 || wasteNot2Time > 0) return actionResult::failHardUnavailable;
-	return commonSynth(-18, 180, 100, 5);
-}
-
-actionResult craft::intensiveSynthesis()
-{
-	if (cond != condition::good && cond != condition::excellent) return actionResult::failSoftUnavailable;
-	return commonSynth(-6, 400, 100);
-}
+	for (size_t i = 0; i < actionTable.size(); ++i)
+	{
+		actionDescriptor& d = actionTable[i];
+		d = actionDescriptors[i];
 
-actionResult craft::muscleMemory()
-{
-	if (step != 1) return actionResult::failHardUnavailable;
-	return commonSynth(-6, 300, 100);
-}
+		if (d.upgradeLevel > 0 && crafter.level >= d.upgradeLevel)
+			d.progressEfficiency = d.upgradedProgressEfficiency;
 
-void craft::muscleMemoryPost()
-{
-	muscleMemoryTime = 5;
-	if (cond == condition::primed)
-		muscleMemoryTime += 2;
+		if (d.needsLowerLevelRecipe && (recipe.expert || crafter.level < rlvlToMain(recipe.rLevel) + 10))
+			d.available = false;
+	}
 }
 
-/***
-TOUCH ACTIONS
-***/
-
-void craft::basicTouchPost()
+// Which branches are taken is decided by the constexpr descriptor, so each instantiation only has the ones
+// its action needs. The values come from the context's resolved copy, since some depend on the crafter.
+template<size_t index>
+actionResult craft::performAction(const actionDescriptor& d)
 {
-	basicTouchCombo = true;
-}
+	constexpr actionDescriptor shape = actionDescriptors[index];
 
-void craft::standardTouchPost()
-{
-	if (basicTouchCombo)
+	if (!shape.available || shape.needsLowerLevelRecipe)
 	{
-		basicTouchCombo = false;
-		standardTouchCombo = true;
+		if (!d.available) return actionResult::failHardUnavailable;
 	}
-}
+	if (shape.firstStepOnly && current.step != 1) return actionResult::failHardUnavailable;
+	if (shape.blockedByWasteNot && (current.wasteNotTime > 0 || current.wasteNot2Time > 0)) return actionResult::failHardUnavailable;
+	if (shape.minimumInnerQuiet > 0 && current.innerQuiet < d.minimumInnerQuiet) return actionResult::failHardUnavailable;
+	if (shape.needsGoodCondition && current.cond != condition::good && current.cond != condition::excellent)
+		return actionResult::failSoftUnavailable;
 
-actionResult craft::byregotsBlessing()
-{
-	if (innerQuiet < 1) return actionResult::failHardUnavailable;
-	actionResult output = commonTouch(-24, 100 + 20 * innerQuiet, 100);
-	if (output != actionResult::failNoCP) innerQuiet = 0;
-	return output;
-}
+	const bool comboActive = shape.combo != nullptr && current.*d.combo;
+	if (!changeCP(-(comboActive ? d.comboCPCost : d.CPCost))) return actionResult::failNoCP;
 
-actionResult craft::preciseTouch()
-{
-	if (cond != condition::good && cond != condition::excellent) return actionResult::failSoftUnavailable;
-	actionResult output = commonTouch(-18, 150, 100);
-	if (output == actionResult::success && innerQuiet < 10) innerQuiet++;
-	return output;
-}
+	actionResult output = actionResult::success;
+	if (shape.successChance >= 100 || rollPercent(comboActive ? d.comboSuccessChance : d.successChance))
+	{
+		if (shape.progressEfficiency > 0)
+		{
+			int efficiency = d.progressEfficiency;
+			if (shape.halvedWithoutDurability && current.durability < getDurabilityCost(d.durabilityCost))
+				efficiency /= 2;
+			increaseProgress(efficiency);
+		}
+		if (shape.qualityEfficiency > 0)
+			increaseQuality(d.qualityEfficiency + d.qualityPerInnerQuiet * current.innerQuiet);
+		if (shape.addsRecipeQuality) current.quality += ctx->recipe.nominalQuality;
+		if (shape.innerQuietGained > 0)
+			current.innerQuiet = min<short>(current.innerQuiet + d.innerQuietGained, context::maxInnerQuiet);
+
+		// Buffs that end the step are applied in performOnePost, but cleared here so the step they're used on doesn't tick them
+		if (shape.buff != nullptr) current.*d.buff = d.endsStep ? 0 : d.buffDuration;
+	}
+	else output = actionResult::failRNG;
 
-actionResult craft::prudentTouch()
-{
-	if (wasteNotTime > 0 || wasteNot2Time > 0) return actionResult::failHardUnavailable;
-	return commonTouch(-25, 100, 100, 5);
-}
+	if (shape.durabilityCost > 0) lowerDurability(d.durabilityCost);
+	if (shape.durabilityRestored > 0) raiseDurability(d.durabilityRestored);
+	if (shape.innerQuietAfter >= 0) current.innerQuiet = d.innerQuietAfter;
 
-actionResult craft::preparatoryTouch()
-{
-	actionResult output = commonTouch(-40, 200, 100, 20);
-	if (output == actionResult::success && innerQuiet < 10) innerQuiet++;
 	return output;
 }
 
-actionResult craft::trainedEye()
-{
-	if (step != 1 || recipe.expert || crafter.level < rlvlToMain(recipe.rLevel) + 10) return actionResult::failHardUnavailable;
-	if (!changeCP(-250)) return actionResult::failNoCP;
-	quality += recipe.nominalQuality;
-	innerQuiet = 1;
-	return actionResult::success;
-}
-
-actionResult craft::trainedFinesse()
-{
-	if (innerQuiet < 10) return actionResult::failHardUnavailable;
-	return commonTouch(-32, 100, 100, 0);
-}
-
-/***
-CP
-***/
-
-actionResult craft::tricksOfTheTrade()
-{
-	if (cond != condition::good && cond != condition::excellent) return actionResult::failSoftUnavailable;
-
-	changeCP(20);
-
-	return actionResult::success;
-}
-
-/***
-DURABILITY
-***/
-
-actionResult craft::mastersMend()
-{
-	if (!changeCP(-88)) return actionResult::failNoCP;
-
-	raiseDurability(30);
-
-	return actionResult::success;
-}
-
-actionResult craft::wasteNot()
+actionResult craft::performOne(actions action, rngOverride override)
 {
-	if (!changeCP(-56)) return actionResult::failNoCP;
+	static const auto executors = makeExecutors(make_index_sequence<static_cast<size_t>(actions::invalid)>());
 
-	return actionResult::success;
-}
-
-void craft::wasteNotPost()
-{
-	wasteNotTime = 4;
-	wasteNot2Time = 0;
-	if (cond == condition::primed)
-		wasteNotTime += 2;
+	over = override;
+	assert(action < actions::invalid);
+	const size_t index = static_cast<size_t>(action);
+	return (this->*executors[index])(ctx->actionTable[index]);
 }
 
-actionResult craft::wasteNot2()
+void craft::performOnePost(actions action)
 {
-	if (!changeCP(-98)) return actionResult::failNoCP;
+	const actionDescriptor& d = ctx->actionTable[static_cast<size_t>(action)];
 
-	return actionResult::success;
-}
+	if (d.buff != nullptr && d.endsStep)
+		current.*d.buff = d.buffDuration + (current.cond == condition::primed ? 2 : 0);
+	if (d.buffCleared != nullptr) current.*d.buffCleared = 0;
 
-void craft::wasteNot2Post()
-{
-	wasteNotTime = 0;
-	wasteNot2Time = 8;
-	if (cond == condition::primed)
-		wasteNot2Time += 2;
+	if (d.startsCombo != nullptr)
+	{
+		if (d.combo == nullptr) current.*d.startsCombo = true;
+		else if (current.*d.combo)
+		{
+			current.*d.combo = false;
+			current.*d.startsCombo = true;
+		}
+	}
 }
 
-actionResult craft::manipulation()
+actionResult craft::performOneComplete(actions action, rngOverride override)
 {
-	if (!changeCP(-96)) return actionResult::failNoCP;
-
-	manipulationTime = 0;
-
-	return actionResult::success;
-}
+	actionResult output = performOne(action, override);
 
-void craft::manipulationPost()
-{
-	manipulationTime = 8;
-	if (cond == condition::primed)
-		manipulationTime += 2;
-}
+	if (output != actionResult::success && output != actionResult::failRNG)
+		return output;
 
-/***
-BUFFS
-***/
+	if (!ctx->actionTable[static_cast<size_t>(action)].endsStep) return output;
 
-actionResult craft::reflect()
-{
-	if (step != 1) return actionResult::failHardUnavailable;
-	actionResult output = commonTouch(-6, 100, 100);
+	endStep(action, output);
 
-	if(output == actionResult::success) innerQuiet++;
+	if(output == actionResult::success) performOnePost(action);
 
 	return output;
 }
 
-actionResult craft::greatStrides()
+bool craft::performInSequence(actions action, bool first, rngOverride override, snapshot& at, actionResult& result)
 {
-	if (!changeCP(-32)) return actionResult::failNoCP;
+	if (first && action == actions::finalAppraisal && current.finalAppraisalTime == 5)
+		at.firstInvalid = true;
 
-	return actionResult::success;
-}
-
-void craft::greatStridesPost()
-{
-	greatStridesTime = 3;
-	if (cond == condition::primed)
-		greatStridesTime += 2;
-}
-
-actionResult craft::veneration()
-{
-	if (!changeCP(-18)) return actionResult::failNoCP;
-
-	return actionResult::success;
-}
-
-void craft::venerationPost()
-{
-	venerationTime = 4;
-	if (cond == condition::primed)
-		venerationTime += 2;
-}
+	result = performOne(action, override);
+	if (first && result != actionResult::success && result != actionResult::failRNG)
+		at.firstInvalid = true;
+	if (result == actionResult::failNoCP || result == actionResult::failHardUnavailable)
+		at.invalidActions++;
+	if (result == actionResult::failSoftUnavailable) at.softInvalids++;
+	if (result != actionResult::success && result != actionResult::failRNG)
+		return true;
 
-actionResult craft::innovation()
-{
-	if (!changeCP(-18)) return actionResult::failNoCP;
+	if (action == actions::finalAppraisal)
+	{
+		at.softInvalids++;	// I have never seen this action be useful in a result.
+		return true;	// since it doesn't tick
+	}
 
-	return actionResult::success;
+	if (current.durability <= 0 || current.progress >= ctx->recipe.difficulty)
+		return false;
+	endStep(action, result);
+	if (result == actionResult::success) performOnePost(action);
+	return true;
 }
 
-void craft::innovationPost()
+craft::snapshot craft::advanceSnapshot(const craft::sequenceType& sequence, snapshot from) const
 {
-	innovationTime = 4;
-	if (cond == condition::primed)
-		innovationTime += 2;
-}
+	if (!ctx->normalLock) return from;
 
-actionResult craft::finalAppraisal()
-{
-	if (!changeCP(-1)) return actionResult::failNoCP;
+	// A parent's snapshot can be decided only because its sequence ended there, which says nothing about this one's
+	from.decided = false;
 
-	finalAppraisalTime = 5;	// here and not in a post since FA doesn't endStep
-	return actionResult::success;
+	// With every roll failing, anything that comes out as a success never rolled at all
+	craft probe(*this);
+	while (from.position < static_cast<int>(sequence.size()))
+	{
+		probe.current = from.current;
+		snapshot next = from;
+		actionResult result;
+		const bool ongoing = probe.performInSequence(sequence[from.position], from.position == 0, rngOverride::failure, next, result);
+		if (result == actionResult::failRNG)
+			return from;
+		if (!ongoing)
+			break;	// it ends here no matter what
+		next.current = probe.current;
+		next.position++;
+		from = next;
+	}
+	from.decided = true;
+	return from;
 }
 
-actionResult craft::observe()
+void craft::branchSnapshot(const craft::sequenceType& sequence, const snapshot& from, vector<branch>& out) const
 {
-	if (!changeCP(-7)) return actionResult::failNoCP;
-	else return actionResult::success;
-}
+	assert(from.position < static_cast<int>(sequence.size()));
+	const actions action = sequence[from.position];
+	const actionDescriptor& d = ctx->actionTable[static_cast<size_t>(action)];
 
-void craft::observePost()
-{
-	observeCombo = true;
-}
+	const bool comboActive = d.combo != nullptr && from.current.*d.combo;
+	int chance = comboActive ? d.comboSuccessChance : d.successChance;
+	if (from.current.cond == condition::centered) chance += 25;
+	chance = min(chance, 100);
 
-actionResult craft::performOne(actions action, rngOverride override)
-{
-	over = override;
-	switch (action)
-	{
-	case actions::basicSynth: return basicSynth();
-	case actions::carefulSynthesis: return carefulSynthesis();
-	case actions::rapidSynthesis: return rapidSynthesis();
-	case actions::focusedSynthesis: return focusedSynthesis();
-	case actions::delicateSynthesis: return delicateSynthesis();
-	case actions::groundwork: return groundwork();
-	case actions::prudentSynthesis: return prudentSynthesis();
-	case actions::intensiveSynthesis: return intensiveSynthesis();
-	case actions::muscleMemory: return muscleMemory();
-	
-	case actions::basicTouch: return basicTouch();
-	case actions::standardTouch: return standardTouch();
-	case actions::advancedTouch: return advancedTouch();
-	case actions::hastyTouch: return hastyTouch();
-	case actions::byregotsBlessing: return byregotsBlessing();
-	case actions::preciseTouch: return preciseTouch();
-	case actions::focusedTouch: return focusedTouch();
-	case actions::prudentTouch: return prudentTouch();
-	case actions::preparatoryTouch: return preparatoryTouch();
-	case actions::trainedEye: return trainedEye();
-	case actions::trainedFinesse: return trainedFinesse();
-
-	case actions::tricksOfTheTrade: return tricksOfTheTrade();
-
-	case actions::mastersMend: return mastersMend();
-	case actions::wasteNot: return wasteNot();
-	case actions::wasteNot2: return wasteNot2();
-	case actions::manipulation: return manipulation();
-
-	case actions::reflect: return reflect();
-	case actions::greatStrides: return greatStrides();
-	case actions::veneration: return veneration();
-	case actions::innovation: return innovation();
-	case actions::finalAppraisal: return finalAppraisal();
-
-	case actions::observe: return observe();
-	case actions::invalid:
-	default:
-		assert(false);
-		return actionResult::failHardUnavailable;
+	// How likely each condition is to come up next
+	array<int, static_cast<size_t>(condition::goodomen) + 1> conditionWeights{};
+	const bool conditionRolls = !ctx->normalLock && from.current.cond != condition::goodomen &&
+		(ctx->recipe.expert || from.current.cond == condition::normal || from.current.cond == condition::centered ||
+		from.current.cond == condition::sturdy || from.current.cond == condition::pliant ||
+		from.current.cond == condition::malleable || from.current.cond == condition::primed);
+	if (conditionRolls)
+	{
+		for (condition c : ctx->conditionByRoll)
+			conditionWeights[static_cast<size_t>(c)]++;
 	}
-}
+	else conditionWeights[static_cast<size_t>(condition::normal)] = static_cast<int>(ctx->conditionByRoll.size());
 
-void craft::performOnePost(actions action)
-{
-	switch (action)
-	{
-	case actions::basicTouch: return basicTouchPost();
-	case actions::standardTouch: return standardTouchPost();
-	case actions::muscleMemory: return muscleMemoryPost();
-	case actions::wasteNot: return wasteNotPost();
-	case actions::wasteNot2: return wasteNot2Post();
-	case actions::manipulation: return manipulationPost();
-	case actions::greatStrides: return greatStridesPost();
-	case actions::veneration: return venerationPost();
-	case actions::innovation: return innovationPost();
-	case actions::observe: return observePost();
-	default: return;
+	craft probe(*this);
+	for (int roll = 0; roll < 2; ++roll)
+	{
+		const int rollChance = roll == 0 ? chance : 100 - chance;
+		if (rollChance == 0) continue;
+		for (size_t c = 0; c < conditionWeights.size(); ++c)
+		{
+			if (conditionWeights[c] == 0) continue;
+			probe.current = from.current;
+			probe.forcedCondition = static_cast<condition>(c);
+			branch b{ from, rollChance * conditionWeights[c] / (100.0 * ctx->conditionByRoll.size()) };
+			actionResult result;
+			if (probe.performInSequence(action, from.position == 0, roll == 0 ? rngOverride::success : rngOverride::failure, b.at, result))
+				b.at.position++;
+			else
+			{
+				b.at.invalidActions += static_cast<int>(sequence.size()) - (from.position + 1);
+				b.at.position = static_cast<int>(sequence.size());
+			}
+			b.at.current = probe.current;
+
+			// If the step didn't end, there was no new condition, so this is the only branch for the roll
+			if (probe.current.step == from.current.step)
+			{
+				b.chance = rollChance / 100.0;
+				out.push_back(b);
+				break;
+			}
+			out.push_back(b);
+		}
 	}
 }
 
-actionResult craft::performOneComplete(actions action, rngOverride override)
+craft::endResult craft::performFrom(const craft::sequenceType& sequence, const snapshot& from, goalType goal, bool echoEach)
 {
-	actionResult output = performOne(action, override);
-
-	if (output != actionResult::success && output != actionResult::failRNG)
-		return output;
-
-	if (action == actions::finalAppraisal) return output;
-
-	endStep(action, output);
-
-	if(output == actionResult::success) performOnePost(action);
-
-	return output;
-}
+	current = from.current;
+	snapshot at = from;
 
-craft::endResult craft::performAll(const craft::sequenceType& sequence, goalType goal, bool echoEach)
-{
 	endResult craftResult;
-	craftResult.invalidActions = 0;
-	craftResult.firstInvalid = false;
-	int softInvalids = 0;
 
 	craft::sequenceType::const_iterator it;
-	for (it = sequence.cbegin(); it != sequence.cend(); ++it)
+	for (it = sequence.cbegin() + from.position; it != sequence.cend(); ++it)
 	{
 		if (echoEach)
 		{
 			cout << getState() << '\n';
-			cout << "Step " << step << ", ";
+			cout << "Step " << current.step << ", ";
 		}
 
-		if (it == sequence.cbegin() && *it == actions::finalAppraisal && finalAppraisalTime == 5)
-			craftResult.firstInvalid = true;
-
-		actionResult result = performOne(*it);
+		actionResult result;
+		const bool ongoing = performInSequence(*it, it == sequence.cbegin(), rngOverride::random, at, result);
 		if (echoEach)
 		{
 			cout << "Performing " << simpleText.at(*it) << ": ";
@@ -797,24 +873,8 @@ craft::endResult craft::performAll(const craft::sequenceType& sequence, goalType
 			}
 			cout << '\n';
 		}
-		if (it == sequence.cbegin() && result != actionResult::success && result != actionResult::failRNG)
-			craftResult.firstInvalid = true;
-		if (result == actionResult::failNoCP || result == actionResult::failHardUnavailable)
-			craftResult.invalidActions++;
-		if (result == actionResult::failSoftUnavailable) softInvalids++;
-		if (result != actionResult::success && result != actionResult::failRNG)
-			continue;
-
-		if (*it == actions::finalAppraisal)
-		{
-			softInvalids++;	// I have never seen this action be useful in a result.
-			continue;	// since it doesn't tick
-		}
-
-		if (durability <= 0 || progress >= recipe.difficulty)
+		if (!ongoing)
 			break;
-		endStep(*it, result);
-		if (result == actionResult::success) performOnePost(*it);
 	}
 
 	if (echoEach)
@@ -822,33 +882,30 @@ craft::endResult craft::performAll(const craft::sequenceType& sequence, goalType
 		cout << getState() << '\n';
 	}
 
-	craftResult.progress = progress;
-	craftResult.quality = quality;
+	craftResult.invalidActions = at.invalidActions;
+	craftResult.firstInvalid = at.firstInvalid;
+	craftResult.progress = current.progress;
+	craftResult.quality = current.quality;
 	switch (goal)
 	{
 	case goalType::hq:
-		craftResult.hqPercent = hqPercentFromQuality((quality * 100) / recipe.nominalQuality);
+		craftResult.hqPercent = hqPercentFromQuality((current.quality * 100) / ctx->recipe.nominalQuality);
 		break;
 	case goalType::maxQuality:
 		break;
 	case goalType::collectability:
-		craftResult.collectableHit = quality >= recipe.quality;
+		craftResult.collectableHit = current.quality >= ctx->recipe.quality;
 		break;
 	case goalType::points:
-		craftResult.points = 0;
-		for (auto p : recipe.points)
-		{
-			if (quality / 10 >= p.first)
-				craftResult.points = p.second;
-		}
+		craftResult.points = ctx->pointsFromQuality(current.quality);
 	}
-	craftResult.steps = step;
+	craftResult.steps = current.step;
 	if (it != sequence.cend()) ++it;	// the iterator needs to sit on the one after the last craft in order for the next calculation to work
 	craftResult.invalidActions += static_cast<int>(distance(it, sequence.cend()));	// Count everything that didn't happen post-macro
 
 	// The solver has a nasty habit of junking up results with soft invalids
 	// So aggressively prune them out of anything that they don't help a 100% qual of.
-	if (quality < recipe.quality) craftResult.invalidActions += softInvalids;
+	if (current.quality < ctx->recipe.quality) craftResult.invalidActions += at.softInvalids;
 
 	return craftResult;
 }
@@ -859,74 +916,95 @@ void craft::setBuff(actions buff, int time)
 	switch (buff)
 	{
 	case actions::innerQuiet:
-		innerQuiet = time;
+		current.innerQuiet = time;
 		return;
 	case actions::muscleMemory:
-		muscleMemoryTime = time;
+		current.muscleMemoryTime = time;
 		return;
 	case actions::wasteNot:
-		wasteNotTime = time;
-		wasteNot2Time = 0;
+		current.wasteNotTime = time;
+		current.wasteNot2Time = 0;
 		return;
 	case actions::wasteNot2:
-		wasteNot2Time = time;
-		wasteNotTime = 0;
+		current.wasteNot2Time = time;
+		current.wasteNotTime = 0;
 		return;
 	case actions::manipulation:
-		manipulationTime = time;
+		current.manipulationTime = time;
 		return;
 	case actions::greatStrides:
-		greatStridesTime = time;
+		current.greatStridesTime = time;
 		return;
 	case actions::veneration:
-		venerationTime = time;
+		current.venerationTime = time;
 		return;
 	case actions::innovation:
-		innovationTime = time;
+		current.innovationTime = time;
 		return;
 	case actions::finalAppraisal:
-		finalAppraisalTime = time;
+		current.finalAppraisalTime = time;
 		return;
 	case actions::basicTouch:
-		basicTouchCombo = time > 0;
+		current.basicTouchCombo = time > 0;
 		return;
 	case actions::standardTouch:
-		standardTouchCombo = time > 0;
+		current.standardTouchCombo = time > 0;
 		return;
 	case actions::observe:
-		observeCombo = time > 0;
+		current.observeCombo = time > 0;
 		return;
 	default:
 		return;
 	}
 }
 
+uint64_t craft::fingerprint() const
+{
+	// A field at a time, so the padding in state doesn't count
+	uint64_t output = 0;
+	auto fold = [&output](int value) { output = splitmix64(output ^ static_cast<uint32_t>(value))(); };
+	fold(current.step);
+	fold(current.durability);
+	fold(current.CP);
+	fold(current.quality);
+	fold(current.progress);
+	fold(current.muscleMemoryTime);
+	fold(current.wasteNotTime);
+	fold(current.wasteNot2Time);
+	fold(current.manipulationTime);
+	fold(current.venerationTime);
+	fold(current.innerQuiet);
+	fold(current.greatStridesTime);
+	fold(current.innovationTime);
+	fold(current.finalAppraisalTime);
+	fold(current.basicTouchCombo);
+	fold(current.standardTouchCombo);
+	fold(current.observeCombo);
+	fold(static_cast<int>(current.cond));
+	return output;
+}
+
 craft::endResult craft::getResult(goalType goal) const
 {
 	endResult craftResult;
 	craftResult.invalidActions = 0;
 	craftResult.firstInvalid = false;
-	craftResult.progress = progress;
-	craftResult.quality = quality;
-	craftResult.steps = step;
+	craftResult.progress = current.progress;
+	craftResult.quality = current.quality;
+	craftResult.steps = current.step;
 
 	switch (goal)
 	{
 	case goalType::hq:
-		craftResult.hqPercent = hqPercentFromQuality((quality * 100) / recipe.nominalQuality);
+		craftResult.hqPercent = hqPercentFromQuality((current.quality * 100) / ctx->recipe.nominalQuality);
 		break;
 	case goalType::maxQuality:
 		break;
 	case goalType::collectability:
-		craftResult.collectableHit = quality >= recipe.quality;
+		craftResult.collectableHit = current.quality >= ctx->recipe.quality;
 		break;
 	case goalType::points:
-		craftResult.points = 0;
-		for (auto p : recipe.points)
-		{
-			if (quality / 10 >= p.first)
-				craftResult.points = p.second;
-		}
+		craftResult.points = ctx->pointsFromQuality(current.quality);
 		break;
 	}
 
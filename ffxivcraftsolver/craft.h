@@ -1,6 +1,10 @@
 #pragma once
 #include <string>
 #include <map>
+#include <array>
+#include <vector>
+#include <type_traits>
+#include <utility>
 #include "common.h"
 #include "levels.h"
 #include "random.h"
@@ -146,41 +150,189 @@ public:
 		random
 	};
 
-private:
-	crafterStats crafter;
-	recipeStats recipe;
+	// Everything about a craft that does change. Kept trivially copyable and small,
+	// so starting a fresh simulation from an initial state is a plain memcpy.
+	struct state
+	{
+		int step;
+		int durability;
+		int CP;
+		int quality;
+		int progress;
 
-	int step;
-	int durability; 
-	int CP;
-	int quality;
-	int progress;
+		// Buffs
+		short muscleMemoryTime;
+		short wasteNotTime;
+		short wasteNot2Time;
+		short manipulationTime;
+		short venerationTime;
+		short innerQuiet;
+		short greatStridesTime;
+		short innovationTime;
+		short finalAppraisalTime;
+		bool basicTouchCombo;	// For BT->ST combo
+		bool standardTouchCombo;	// for ST->AT combo
+		bool observeCombo;	// For Focused combo
+
+		condition cond;
+	};
 
-	// Each entry as integer percentage. Normal not included
-	std::map<condition, int> conditionChances;
-	condition cond;
+	// How far a simulation has got through a sequence, so another simulation of it can carry on from there
+	struct snapshot
+	{
+		state current;
+		int position;		// how many of the sequence's actions are done with (performed or not)
+		int invalidActions;
+		int softInvalids;
+		bool firstInvalid;
+		bool decided;		// nothing left in the sequence can differ between sims, so one sim is as good as any number
+	};
 
-	// Buffs
-	int muscleMemoryTime = 0;
-	int wasteNotTime = 0;
-	int wasteNot2Time = 0;
-	int manipulationTime = 0;
-	int venerationTime = 0;
-	int innerQuiet = 0;
-	int greatStridesTime = 0;
-	int innovationTime = 0;
-	int finalAppraisalTime = 0;
-	bool basicTouchCombo = false;	// For BT->ST combo
-	bool standardTouchCombo = false;	// for ST->AT combo
-	bool observeCombo = false;	// For Focused combo
-
-	bool normalLock;
+	// How an action behaves, as data. actionDescriptors in craft.cpp holds one for every action,
+	// and each context resolves the level-dependent parts for its crafter so performOne can just interpret them.
+	struct actionDescriptor
+	{
+		actions action = actions::invalid;
+
+		int CPCost = 0;			// negative restores CP
+		int progressEfficiency = 0;
+		int qualityEfficiency = 0;
+		int successChance = 100;
+		int durabilityCost = 0;
+		int durabilityRestored = 0;
+
+		int upgradeLevel = 0;	// the level upgradedProgressEfficiency replaces progressEfficiency, 0 if never
+		int upgradedProgressEfficiency = 0;
+
+		// If this combo is active, the action uses the combo cost and chance instead
+		bool state::* combo = nullptr;
+		int comboCPCost = 0;
+		int comboSuccessChance = 100;
+		// Set after the step ends. If combo is also set, this only starts out of that combo
+		bool state::* startsCombo = nullptr;
+
+		// Set after the step ends, plus 2 if the new condition is primed
+		short state::* buff = nullptr;
+		short buffDuration = 0;
+		short state::* buffCleared = nullptr;
+
+		// Preconditions
+		bool firstStepOnly = false;
+		bool blockedByWasteNot = false;
+		bool needsGoodCondition = false;	// good or excellent. A soft failure, since the condition may proc
+		int minimumInnerQuiet = 0;
+		bool needsLowerLevelRecipe = false;	// not expert, and at least 10 levels under the crafter
+
+		int qualityPerInnerQuiet = 0;	// added to the quality efficiency for each stack
+		int innerQuietGained = 0;		// on success, on top of the stack from increasing quality. Capped at 10
+		int innerQuietAfter = -1;		// what inner quiet is set to once the action goes off, or -1 to leave it
+		bool addsRecipeQuality = false;
+		bool halvedWithoutDurability = false;	// progress efficiency, if there isn't enough durability to pay for it
+
+		bool endsStep = true;	// if not, the buff applies immediately
+		bool available = true;
+	};
+
+	// Everything about a craft that doesn't change as actions are performed.
+	// Built once, then shared read-only by every craft (and every thread) simulating it.
+	struct context
+	{
+		crafterStats crafter;
+		recipeStats recipe;
+
+		// The condition for each possible 0-99 roll, built from the recipe's conditions flag
+		std::array<condition, 100> conditionByRoll;
+
+		// Every action's descriptor, with its efficiencies and availability resolved for this crafter and recipe
+		std::array<actionDescriptor, static_cast<size_t>(actions::invalid)> actionTable;
+
+		bool normalLock;
+
+		context() = delete;
+		context(const crafterStats& cS, const recipeStats& rS, bool nLock);
+		// Of everything the context was built from, for telling apart results that came from different crafts
+		uint64_t fingerprint() const;
+
+		// Efficiencies outside the tables (or not on their step) fall back to the full calculation
+		static constexpr int maxProgressEfficiency = 500;
+		static constexpr int progressEfficiencyStep = 10;
+		static constexpr int maxQualityEfficiency = 300;
+		static constexpr int qualityEfficiencyStep = 5;
+		static constexpr int maxInnerQuiet = 10;
+
+		int progressIncrease(int efficiency, bool malleable, bool muscleMemory, bool veneration) const
+		{
+			if (efficiency < 0 || efficiency > maxProgressEfficiency || efficiency % progressEfficiencyStep != 0)
+				return calculateProgressIncrease(efficiency, malleable, muscleMemory, veneration);
+			size_t buffs = (malleable ? 4 : 0) + (muscleMemory ? 2 : 0) + (veneration ? 1 : 0);
+			return progressIncreases[buffs * progressEfficiencies + efficiency / progressEfficiencyStep];
+		}
+
+		int qualityIncrease(int efficiency, condition cond, bool greatStrides, bool innovation, int innerQuiet) const
+		{
+			if (efficiency < 0 || efficiency > maxQualityEfficiency || efficiency % qualityEfficiencyStep != 0 ||
+				innerQuiet < 0 || innerQuiet > maxInnerQuiet)
+				return calculateQualityIncrease(efficiency, cond, greatStrides, innovation, innerQuiet);
+			size_t buffs = (qualityConditionIndex(cond) * 4) + (greatStrides ? 2 : 0) + (innovation ? 1 : 0);
+			return qualityIncreases[(buffs * (maxInnerQuiet + 1) + innerQuiet) * qualityEfficiencies + efficiency / qualityEfficiencyStep];
+		}
+
+		static constexpr size_t progressEfficiencies = maxProgressEfficiency / progressEfficiencyStep + 1;
+		static constexpr size_t qualityEfficiencies = maxQualityEfficiency / qualityEfficiencyStep + 1;
+
+		// The raw tables, laid out as described below, for the batch simulator
+		const int* progressTable() const { return progressIncreases.data(); }
+		const int* qualityTable() const { return qualityIncreases.data(); }
+
+		// Turnin points for a given quality. 0 if the recipe has no points
+		int pointsFromQuality(int quality) const
+		{
+			if (pointsByCollectability.empty()) return 0;
+			size_t collectability = std::min(static_cast<size_t>(quality / 10), pointsByCollectability.size() - 1);
+			return pointsByCollectability[collectability];
+		}
+
+	private:
+		// [malleable][muscle memory][veneration][efficiency]
+		std::vector<int> progressIncreases;
+		// [poor/normal/good/excellent][great strides][innovation][inner quiet][efficiency]
+		std::vector<int> qualityIncreases;
+		// index is quality / 10, with anything past the end worth the last entry
+		std::vector<int> pointsByCollectability;
+
+		// Only poor, good and excellent change quality; everything else counts as normal
+		static size_t qualityConditionIndex(condition cond)
+		{
+			switch (cond)
+			{
+			case condition::poor: return 0;
+			case condition::good: return 2;
+			case condition::excellent: return 3;
+			default: return 1;
+			}
+		}
+
+		int calculateProgressIncrease(int efficiency, bool malleable, bool muscleMemory, bool veneration) const;
+		int calculateQualityIncrease(int efficiency, condition cond, bool greatStrides, bool innovation, int innerQuiet) const;
+
+		void setProbabilities();
+		void buildTables();
+		void resolveActions();
+	};
+
+private:
+	const context* ctx;
+	state current;
 
 	randomGenerator* rng;
+	const luckTapes* luck;	// if set, rolls come from here instead of rng
+	int tape;
+	double luckWeight;	// the product of luckTapes::ratio over every roll taken from the tape
 	rngOverride over;
+	condition forcedCondition;	// what the condition rolls into when over isn't random
 
 	// chance == 70 means 70% success and so on
-	inline bool rollPercent(int chance) const;
+	inline bool rollPercent(int chance);
 
 	void increaseProgress(int efficiency);
 	void increaseQuality(int efficiency);
@@ -190,24 +342,22 @@ private:
 
 	int getDurabilityCost(int base)
 	{
-		if (wasteNotTime > 0 || wasteNot2Time > 0) base -= base/ 2;
-		if (cond == condition::sturdy) base -= base / 2;
+		if (current.wasteNotTime > 0 || current.wasteNot2Time > 0) base -= base/ 2;
+		if (current.cond == condition::sturdy) base -= base / 2;
 		return base;
 	}
 
 	void raiseDurability(int amount)
 	{
-		durability = std::min(durability + amount, recipe.durability);
+		current.durability = std::min(current.durability + amount, ctx->recipe.durability);
 	}
 
 	void lowerDurability(int amount = 10)
 	{
-		durability -= getDurabilityCost(amount);
+		current.durability -= getDurabilityCost(amount);
 	}
 
-	void setProbabilities();
-
-	condition getNextCondition(condition current);
+	condition getNextCondition(condition currentCondition);
 	void endStep(actions action, actionResult result);
 
 	// both percentages from 0-100
@@ -219,101 +369,101 @@ public:
 	craft(craft&&) = default;
 	craft& operator=(const craft&) = default;
 
-	craft(int initialQuality, crafterStats cS, recipeStats rS, bool nLock) :
-		crafter(cS),
-		recipe(rS),
-		step(1),
-		durability(recipe.durability),
-		CP(crafter.CP),
-		quality(initialQuality),
-		progress(0),
-		cond(condition::normal),
-		normalLock(nLock),
-		rng(nullptr)
+	// The context must outlive the craft and any copies of it
+	craft(int initialQuality, const context& c) :
+		ctx(&c),
+		current{},
+		rng(nullptr),
+		luck(nullptr),
+		tape(0),
+		luckWeight(1.0),
+		over(rngOverride::random),
+		forcedCondition(condition::normal)
 	{
-		setProbabilities();
+		current.step = 1;
+		current.durability = ctx->recipe.durability;
+		current.CP = ctx->crafter.CP;
+		current.quality = initialQuality;
+		current.progress = 0;
+		current.cond = condition::normal;
 	}
 
 	std::string getState() const;
+	const state& getSnapshot() const { return current; }
+	// The same for crafts in the same state, so results worked out from one can be kept for the other
+	uint64_t fingerprint() const;
 
 	void setRNG(randomGenerator* r) { rng = r; }
+	// Replays one of the tapes, which must outlive any rolls made with them
+	void setLuck(const luckTapes* l, int t) { luck = l; tape = t; luckWeight = 1.0; }
+	// What this craft's result is worth against one with even rolls. Only ever not 1 with weighted tapes
+	double getLuckWeight() const { return luckWeight; }
 
-private:
-	actionResult commonSynth(int cpChange, int efficiency, int successChance, int durabilityCost = 10);
-	actionResult commonTouch(int cpChange, int efficiency, int successChance, int durabilityCost = 10);
-
-	// Synthesis
-	actionResult basicSynth() { return commonSynth(0, crafter.level >= 31 ? 120 : 100, 100); }
-	actionResult carefulSynthesis() { return commonSynth(-7, crafter.level >= 82 ? 180 : 150, 100); }
-	actionResult rapidSynthesis() { return commonSynth(0, crafter.level >= 63 ? 500 : 250, 50); }
-	actionResult focusedSynthesis() { return commonSynth(-5, 200, observeCombo ? 100 : 50); }
-	actionResult delicateSynthesis();
-	actionResult groundwork();
-	actionResult prudentSynthesis();
-	actionResult intensiveSynthesis();
-	actionResult muscleMemory();
-	void muscleMemoryPost();
-
-	// Touches
-	actionResult basicTouch() { return commonTouch(-18, 100, 100); }
-	void basicTouchPost();
-	actionResult standardTouch() { return commonTouch(basicTouchCombo ? -18 : -32, 125, 100); }
-	void standardTouchPost();
-	actionResult advancedTouch() { return commonTouch(standardTouchCombo ? -18 : -46, 150, 100); }
-	actionResult hastyTouch() { return commonTouch(0, 100, 60); }
-	actionResult byregotsBlessing();
-	actionResult preciseTouch();
-	actionResult focusedTouch() { return commonTouch(-18, 150, observeCombo ? 100 : 50); }
-	actionResult prudentTouch();
-	actionResult preparatoryTouch();
-	actionResult trainedEye();
-	actionResult trainedFinesse();
-
-	// CP
-	actionResult tricksOfTheTrade();
-
-	// Durability
-	actionResult mastersMend();
-	actionResult wasteNot();
-	void wasteNotPost();
-	actionResult wasteNot2();
-	void wasteNot2Post();
-	actionResult manipulation();
-	void manipulationPost();
+	const context& getContext() const { return *ctx; }
+	void setContext(const context& c) { ctx = &c; }
 
-	// Buffs
-	actionResult reflect();
-	actionResult greatStrides();
-	void greatStridesPost();
-	actionResult veneration();
-	void venerationPost();
-	actionResult innovation();
-	void innovationPost();
-	actionResult finalAppraisal();
-
-	actionResult observe();
-	void observePost();
+private:
+	// The one executor for every action. It's instantiated per action so the compiler can drop whatever
+	// that action's descriptor doesn't use, and performOne dispatches to it through a table.
+	template<size_t index> actionResult performAction(const actionDescriptor& d);
+	using actionExecutor = actionResult (craft::*)(const actionDescriptor&);
+	template<size_t... indices>
+	static std::array<actionExecutor, sizeof...(indices)> makeExecutors(std::index_sequence<indices...>)
+	{
+		return {{ &craft::performAction<indices>... }};
+	}
 
 	actionResult performOne(actions action, rngOverride override = rngOverride::random);
 	void performOnePost(actions action);
 
+	// One action of a sequence, as performAll does it, tallying into at (but leaving at.current alone).
+	// Returns false if the craft is over.
+	bool performInSequence(actions action, bool first, rngOverride override, snapshot& at, actionResult& result);
+
 public:
 	// Also ends the step and does the post action
 	actionResult performOneComplete(actions action, rngOverride override);
-	endResult performAll(const sequenceType& sequence, goalType goal, bool echoEach = false);
-
-	void setStep(int s) { step = s; }
-	int getStep() const { return step; }
-	void setDurability(int d) { durability = std::min(d, recipe.durability); }
-	bool outOfDurability() const { return durability <= 0; }
-	void setProgress(int p) { progress = p; }
-	bool maxedProgress() const { return progress >= recipe.difficulty; }
-	void setQuality(int q) { quality = q; }
-	void setCondition(condition c) { cond = c; }
-	condition getCondition() const { return cond; }
-	void setCP(int cp) { CP = std::min(cp, crafter.CP); }
+	endResult performAll(const sequenceType& sequence, goalType goal, bool echoEach = false)
+	{
+		return performFrom(sequence, startSnapshot(), goal, echoEach);
+	}
+	// The rest of the sequence, from a snapshot taken of it
+	endResult performFrom(const sequenceType& sequence, const snapshot& from, goalType goal, bool echoEach = false);
+
+	snapshot startSnapshot() const { return snapshot{ current, 0, 0, 0, false, false }; }
+	// Carries a snapshot forward for as long as every simulation of the sequence would agree,
+	// which under normal lock is up to the first action that rolls or ends the craft. Without it, the conditions don't agree.
+	// Not even under common random numbers: each tape's sims would agree, but the tapes are drawn again every generation,
+	// so a snapshot for each would be used once at most.
+	// If it gets to the end of the sequence, or the craft ends without a roll, the snapshot is decided.
+	snapshot advanceSnapshot(const sequenceType& sequence, snapshot from) const;
+
+	struct branch
+	{
+		snapshot at;
+		double chance;
+	};
+	// Every way the snapshot's next action can go, rolls and the next condition both, appended to out.
+	// A branch that ends the craft comes back at the end of the sequence with the rest counted as invalid.
+	// The same snapshot can come up more than once.
+	void branchSnapshot(const sequenceType& sequence, const snapshot& from, std::vector<branch>& out) const;
+
+	void setStep(int s) { current.step = s; }
+	int getStep() const { return current.step; }
+	void setDurability(int d) { current.durability = std::min(d, ctx->recipe.durability); }
+	bool outOfDurability() const { return current.durability <= 0; }
+	void setProgress(int p) { current.progress = p; }
+	bool maxedProgress() const { return current.progress >= ctx->recipe.difficulty; }
+	void setQuality(int q) { current.quality = q; }
+	void setCondition(condition c) { current.cond = c; }
+	condition getCondition() const { return current.cond; }
+	void setCP(int cp) { current.CP = std::min(cp, ctx->crafter.CP); }
 	void setBuff(actions buff, int time);
 
 	// Won't contain invalid stats
 	endResult getResult(goalType goal) const;
 };
+
+static_assert(std::is_trivially_copyable<craft::state>::value, "craft::state must stay a plain memcpy");
+static_assert(sizeof(craft::state) <= 64, "craft::state should fit in a cache line");
+static_assert(std::is_trivially_copyable<craft>::value, "copying a craft must not allocate");
@@ -0,0 +1,109 @@
+#include <functional>
+#include "exact.h"
+
+using namespace std;
+
+// Field by field: snapshots have padding, and copies of them don't promise anything about it
+size_t exactEvaluator::snapshotHash::operator()(const craft::snapshot& s) const
+{
+	const craft::state& c = s.current;
+	const int fields[] = {
+		c.step, c.durability, c.CP, c.quality, c.progress,
+		c.muscleMemoryTime, c.wasteNotTime, c.wasteNot2Time, c.manipulationTime, c.venerationTime,
+		c.innerQuiet, c.greatStridesTime, c.innovationTime, c.finalAppraisalTime,
+		(c.basicTouchCombo ? 1 : 0) | (c.standardTouchCombo ? 2 : 0) | (c.observeCombo ? 4 : 0) | (s.firstInvalid ? 8 : 0),
+		static_cast<int>(c.cond),
+		s.position, s.invalidActions, s.softInvalids
+	};
+	size_t output = 0;
+	for (int val : fields)
+	{
+		// From Boost's hash_combine
+		output ^= hash<int>()(val) + 0x9e3779b9 + (output << 6) + (output >> 2);
+	}
+	return output;
+}
+
+bool exactEvaluator::snapshotEqual::operator()(const craft::snapshot& a, const craft::snapshot& b) const
+{
+	const craft::state& x = a.current;
+	const craft::state& y = b.current;
+	return x.step == y.step && x.durability == y.durability && x.CP == y.CP && x.quality == y.quality && x.progress == y.progress &&
+		x.muscleMemoryTime == y.muscleMemoryTime && x.wasteNotTime == y.wasteNotTime && x.wasteNot2Time == y.wasteNot2Time &&
+		x.manipulationTime == y.manipulationTime && x.venerationTime == y.venerationTime && x.innerQuiet == y.innerQuiet &&
+		x.greatStridesTime == y.greatStridesTime && x.innovationTime == y.innovationTime && x.finalAppraisalTime == y.finalAppraisalTime &&
+		x.basicTouchCombo == y.basicTouchCombo && x.standardTouchCombo == y.standardTouchCombo && x.observeCombo == y.observeCombo &&
+		x.cond == y.cond &&
+		a.position == b.position && a.invalidActions == b.invalidActions && a.softInvalids == b.softInvalids && a.firstInvalid == b.firstInvalid;
+}
+
+exactEvaluator::exactEvaluator(const craft& initial) :
+	initialState(initial)
+{
+}
+
+void exactEvaluator::addFinished(const craft::sequenceType& sequence, const craft::snapshot& finished, double chance, goalType goal, expectedResult& out) const
+{
+	// Nothing left to perform, so this just reads the result off the snapshot
+	craft synth(initialState);
+	const craft::endResult result = synth.performFrom(sequence, finished, goal);
+
+	out.progress += result.progress * chance;
+	if (result.progress >= initialState.getContext().recipe.difficulty)
+	{
+		out.successes += chance;
+		out.quality += result.quality * chance;
+		switch (goal)
+		{
+		case goalType::hq:
+			out.hqPercent += result.hqPercent * chance;
+			break;
+		case goalType::maxQuality:
+			break;
+		case goalType::collectability:
+			if (result.collectableHit) out.collectableGoalsHit += chance;
+			break;
+		case goalType::points:
+			out.points += result.points * chance;
+			break;
+		}
+	}
+	out.steps += result.steps * chance;
+	out.invalidActions += result.invalidActions * chance;
+	if (result.firstInvalid) out.firstInvalid = true;
+}
+
+bool exactEvaluator::evaluate(const craft::sequenceType& sequence, const craft::snapshot& from, goalType goal, size_t budget, expectedResult& out)
+{
+	out = expectedResult{};
+	const int end = static_cast<int>(sequence.size());
+
+	frontier.clear();
+	frontier.emplace(from, 1.0);
+	// Every branch moves on exactly one action, so the frontier is always at one position
+	for (int position = from.position; position < end && !frontier.empty(); ++position)
+	{
+		next.clear();
+		for (const auto& entry : frontier)
+		{
+			branches.clear();
+			initialState.branchSnapshot(sequence, entry.first, branches);
+			if (branches.size() > budget) return false;
+			budget -= branches.size();
+			for (const craft::branch& b : branches)
+			{
+				const double chance = entry.second * b.chance;
+				if (b.at.position == end)
+					addFinished(sequence, b.at, chance, goal, out);
+				else
+					next[b.at] += chance;
+			}
+		}
+		swap(frontier, next);
+	}
+
+	for (const auto& entry : frontier)
+		addFinished(sequence, entry.first, entry.second, goal, out);
+
+	return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include "craft.h"
+
+// Works out what a sequence does on average by following every roll and condition with its probability,
+// merging the branches that come back to the same snapshot after each action. No sims, so no noise,
+// but the number of snapshots can blow up on long, touch-heavy sequences, so it gives up past a budget.
+class exactEvaluator
+{
+public:
+	// The expected value of each of solver::netResult's sums for a single craft
+	struct expectedResult
+	{
+		double successes;
+		double progress;
+		double quality;
+		double hqPercent;
+		double collectableGoalsHit;
+		double points;
+		double steps;
+		double invalidActions;
+		bool firstInvalid;	// if any branch has it
+	};
+
+private:
+	struct snapshotHash
+	{
+		size_t operator()(const craft::snapshot& s) const;
+	};
+	struct snapshotEqual
+	{
+		bool operator()(const craft::snapshot& a, const craft::snapshot& b) const;
+	};
+	using frontierType = std::unordered_map<craft::snapshot, double, snapshotHash, snapshotEqual>;
+
+	const craft& initialState;
+
+	// kept between calls so they don't have to allocate every time
+	frontierType frontier, next;
+	std::vector<craft::branch> branches;
+
+	void addFinished(const craft::sequenceType& sequence, const craft::snapshot& finished, double chance, goalType goal, expectedResult& out) const;
+
+public:
+	exactEvaluator() = delete;
+	exactEvaluator(const exactEvaluator&) = delete;
+	exactEvaluator& operator=(const exactEvaluator&) = delete;
+
+	// The craft must outlive the evaluator
+	explicit exactEvaluator(const craft& initial);
+
+	// from must be a snapshot of the sequence. Returns false if following the branches would take more than budget actions,
+	// in which case out is left incomplete. Sims of the rest of the sequence cost one action per sim per action left
+	bool evaluate(const craft::sequenceType& sequence, const craft::snapshot& from, goalType goal, size_t budget, expectedResult& out);
+};
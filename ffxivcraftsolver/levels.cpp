@@ -17,6 +17,7 @@ struct recipeData
 	uint8_t qualityFactor;
 	uint8_t progressPenalty;
 	uint8_t qualityPenalty;
+	uint16_t conditionsFlag;
 };
 
 // Accessed by multiple threads, but only written before they are started
@@ -42,7 +43,8 @@ bool populateRecipeTable(const string& fileName)
 			static_cast<uint8_t>(atoi(split[7].c_str())),	// progressFactor
 			static_cast<uint8_t>(atoi(split[8].c_str())),	// qualityFactor
 			static_cast<uint8_t>(atoi(split[9].c_str())),	// progressPenalty
-			static_cast<uint8_t>(atoi(split[10].c_str()))	// qualityPenalty
+			static_cast<uint8_t>(atoi(split[10].c_str())),	// qualityPenalty
+			static_cast<uint16_t>(split.size() > 12 ? atoi(split[12].c_str()) : 0)	// conditionsFlag
 		};
 		if (rLvl == 0 ||
 			recipe.classLevel == 0 ||
@@ -55,6 +57,11 @@ bool populateRecipeTable(const string& fileName)
 	return true;
 }
 
+bool recipeTableLoaded()
+{
+	return !recipeDataTable.empty();
+}
+
 const array<int, 40> cLevelToRLevel = {
 	120, 125, 130, 133, 136, 139, 142, 145, 148, 150,	// 51-60
 	260, 265, 270, 273, 276, 279, 282, 285, 288, 290,	// 61-70
@@ -122,4 +129,15 @@ int getQualityPenalty(int rLvl)
 	if (it == recipeDataTable.end()) return 0;
 
 	return it->second.qualityPenalty;
+}
+
+int getConditionsFlag(int rLvl)
+{
+	assert(!recipeDataTable.empty());
+
+	if (rLvl < 1) rLvl = 1;
+	auto it = recipeDataTable.find(rLvl);
+	if (it == recipeDataTable.end()) return 0;
+
+	return it->second.conditionsFlag;
 }
\ No newline at end of file
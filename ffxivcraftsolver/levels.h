@@ -4,6 +4,9 @@
 
 bool populateRecipeTable(const std::string& fileName);
 
+// Whether populateRecipeTable has succeeded. The getters below can't be used until then
+bool recipeTableLoaded();
+
 int mainToRlvl(int level);
 
 int rlvlToMain(int level);
@@ -15,3 +18,5 @@ int getQualityFactor(int rLvl);
 int getProgressPenalty(int rLvl);
 
 int getQualityPenalty(int rLvl);
+
+int getConditionsFlag(int rLvl);
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "mappedfile.h"
+
+#if defined _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+#if defined _WIN32
+
+mappedFile::mappedFile() :
+	base(nullptr),
+	length(0),
+	file(INVALID_HANDLE_VALUE),
+	mapping(nullptr)
+{
+}
+
+void mappedFile::close()
+{
+	if (base != nullptr) UnmapViewOfFile(base);
+	if (mapping != nullptr) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	base = nullptr;
+	length = 0;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
+
+bool mappedFile::open(const string& path, size_t size, const preparer& prepare)
+{
+	close();
+	file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	// Everyone with the file mapped holds a shared lock on it for as long as they do, so whoever gets it exclusively has
+	// it to themselves. Anyone else waits for them to finish setting it up
+	OVERLAPPED whole = {};
+	const bool alone = LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, MAXDWORD, MAXDWORD, &whole) != 0;
+	if (!alone && !LockFileEx(file, 0, 0, MAXDWORD, MAXDWORD, &whole))
+	{
+		close();
+		return false;
+	}
+
+	bool ready = false;
+	bool created = false;
+	LARGE_INTEGER existing;
+	if (GetFileSizeEx(file, &existing))
+	{
+		created = existing.QuadPart == 0;
+		LARGE_INTEGER wanted;
+		wanted.QuadPart = static_cast<LONGLONG>(size);
+		// Extending a file fills it with zeroes. Only whoever has it to themselves can make it
+		if (!created || (alone && SetFilePointerEx(file, wanted, nullptr, FILE_BEGIN) && SetEndOfFile(file)))
+		{
+			length = created ? size : static_cast<size_t>(existing.QuadPart);
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+			if (mapping != nullptr)
+				base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+			ready = base != nullptr && prepare(base, length, created, alone);
+		}
+	}
+
+	// Don't leave a file of zeroes behind for the next open to turn away. Anyone else waiting on the lock sees it empty
+	if (!ready && created && alone)
+	{
+		if (base != nullptr) UnmapViewOfFile(base);
+		if (mapping != nullptr) CloseHandle(mapping);
+		base = nullptr;
+		mapping = nullptr;
+		LARGE_INTEGER start = {};
+		if (SetFilePointerEx(file, start, nullptr, FILE_BEGIN)) SetEndOfFile(file);
+	}
+
+	// Shared from here on. Closing the handle lets the lock go
+	if (ready && alone)
+	{
+		UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &whole);
+		ready = LockFileEx(file, 0, 0, MAXDWORD, MAXDWORD, &whole) != 0;
+	}
+	if (!ready) close();
+	if (!ready && created && alone) DeleteFileA(path.c_str());
+	return ready;
+}
+
+#else
+
+mappedFile::mappedFile() :
+	base(nullptr),
+	length(0),
+	descriptor(-1)
+{
+}
+
+void mappedFile::close()
+{
+	if (base != nullptr) munmap(base, length);
+	if (descriptor >= 0) ::close(descriptor);
+	base = nullptr;
+	length = 0;
+	descriptor = -1;
+}
+
+bool mappedFile::open(const string& path, size_t size, const preparer& prepare)
+{
+	close();
+	descriptor = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (descriptor < 0) return false;
+
+	// Everyone with the file mapped holds a shared lock on it for as long as they do, so whoever gets it exclusively has
+	// it to themselves. Anyone else waits for them to finish setting it up
+	const bool alone = flock(descriptor, LOCK_EX | LOCK_NB) == 0;
+	if (!alone && flock(descriptor, LOCK_SH) != 0)
+	{
+		close();
+		return false;
+	}
+
+	bool ready = false;
+	bool created = false;
+	struct stat status;
+	if (fstat(descriptor, &status) == 0)
+	{
+		created = status.st_size == 0;
+		// Extending a file fills it with zeroes. Only whoever has it to themselves can make it
+		if (!created || (alone && ftruncate(descriptor, static_cast<off_t>(size)) == 0))
+		{
+			length = created ? size : static_cast<size_t>(status.st_size);
+			void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+			if (mapped != MAP_FAILED)
+				base = static_cast<char*>(mapped);
+			ready = base != nullptr && prepare(base, length, created, alone);
+		}
+	}
+
+	// Don't leave a file of zeroes behind for the next open to turn away. Anyone else waiting on the lock sees it empty
+	if (!ready && created && alone && ftruncate(descriptor, 0) == 0)
+		unlink(path.c_str());
+
+	// Shared from here on. Closing the descriptor lets the lock go
+	if (ready && alone && flock(descriptor, LOCK_SH) != 0) ready = false;
+	if (!ready) close();
+	return ready;
+}
+
+#endif // defined _WIN32
+
+mappedFile::~mappedFile()
+{
+	close();
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <functional>
+
+// A file mapped into memory read-write and shared, so every process with it open sees the others' writes as they make them
+class mappedFile
+{
+	char* base;
+	size_t length;
+#if defined _WIN32
+	void* file;
+	void* mapping;
+#else
+	int descriptor;
+#endif
+
+	void close();
+
+public:
+	// Given the mapping, whether the file was just made, and whether nobody else has it open. Returns false if the file won't do
+	using preparer = std::function<bool(char* data, size_t length, bool created, bool alone)>;
+
+	mappedFile();
+	~mappedFile();
+	mappedFile(const mappedFile&) = delete;
+	mappedFile& operator=(const mappedFile&) = delete;
+
+	// Maps path, making it size bytes of zeroes first if it's missing or empty. An existing file keeps its own size.
+	// prepare runs with the file locked, so no other process opening it at the same time sees it half set up.
+	// The file is only made by a process that has it to itself, and is removed again if that fails. It stays locked
+	// shared while it's mapped, which is how a later open knows whether it's alone
+	bool open(const std::string& path, size_t size, const preparer& prepare);
+
+	char* data() const
+	{
+		return base;
+	}
+	size_t size() const
+	{
+		return length;
+	}
+};
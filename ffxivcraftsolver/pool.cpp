@@ -0,0 +1,80 @@
+#include <cassert>
+#include <algorithm>
+#include "pool.h"
+
+// for thread priorities
+#if defined _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace std;
+
+workerPool::workerPool() :
+	threadCount(0),
+	sharesQueued(0),
+	currentPass(0)
+{
+}
+
+workerPool& workerPool::instance()
+{
+	// Never destroyed: joining threads while the process exits can deadlock (e.g. under a DLL's loader lock),
+	// and the workers are idle by then anyway
+	static workerPool* pool = new workerPool;
+	return *pool;
+}
+
+void workerPool::reserve(int count)
+{
+	lock_guard<mutex> guard(lock);
+	// The threads are never joined, for the same reason the pool is never destroyed
+	for (; threadCount < count; ++threadCount)
+		thread(&workerPool::workerMain, this).detach();
+}
+
+void workerPool::submit(share work, int shares, int priority)
+{
+	assert(shares > 0 && priority > 0);
+
+	unique_lock<mutex> guard(lock);
+	assert(threadCount > 0);
+	jobs.push_back(make_shared<job>(job{ move(work), shares, shares, priority, currentPass }));
+	sharesQueued.fetch_add(shares, memory_order_relaxed);
+	guard.unlock();
+
+	jobAdded.notify_all();
+}
+
+void workerPool::workerMain()
+{
+#if defined _WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#endif // defined _WIN32
+
+	randomGenerator rng;
+	unique_lock<mutex> guard(lock);
+	while (true)
+	{
+		if (jobs.empty())
+		{
+			guard.unlock();
+			spinUntil([this]() { return sharesQueued.load(memory_order_relaxed) > 0; });
+			guard.lock();
+			jobAdded.wait(guard, [this]() { return !jobs.empty(); });
+		}
+
+		auto next = min_element(jobs.begin(), jobs.end(),
+			[](const shared_ptr<job>& a, const shared_ptr<job>& b) { return a->pass < b->pass; });
+		const shared_ptr<job> picked = *next;
+		const int index = picked->shares - picked->sharesLeft;
+		currentPass = picked->pass;
+		picked->pass += 1.0 / picked->priority;
+		if (--picked->sharesLeft == 0) jobs.erase(next);
+		sharesQueued.fetch_sub(1, memory_order_relaxed);
+
+		guard.unlock();
+		picked->work(index, rng);
+		guard.lock();
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "random.h"
+
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+// How long a thread with nothing to do keeps checking before it goes to sleep. Orders on small populations take
+// microseconds, so the next one usually turns up within this and nobody has to be woken
+constexpr std::chrono::microseconds spinTime(100);
+
+// Spins until ready() or spinTime is up, returning ready(). Doesn't spin at all on a single core,
+// where the thread it's waiting on can't run until it stops
+template <typename predicate>
+bool spinUntil(predicate ready)
+{
+	static const bool worthSpinning = std::thread::hardware_concurrency() > 1;
+	if (ready()) return true;
+	if (!worthSpinning) return false;
+
+	const auto stop = std::chrono::steady_clock::now() + spinTime;
+	do
+	{
+		for (int i = 0; i < 64; ++i)
+		{
+#if defined _MSC_VER
+			_mm_pause();
+#elif defined __i386__ || defined __x86_64__
+			__builtin_ia32_pause();
+#endif
+			if (ready()) return true;
+		}
+	} while (std::chrono::steady_clock::now() < stop);
+	return ready();
+}
+
+// What the main thread waits on for the shares of an order. The waiter spins first and only sleeps
+// (and the last share only takes the lock to wake it) if the shares take longer than that
+class shareLatch
+{
+	std::atomic<int> remaining;
+	std::atomic<bool> sleeping;
+	std::mutex lock;
+	std::condition_variable done;
+
+public:
+	shareLatch() :
+		remaining(0),
+		sleeping(false)
+	{}
+
+	// Only while nobody's waiting or arriving
+	void reset(int shares)
+	{
+		remaining.store(shares, std::memory_order_relaxed);
+	}
+
+	void arrive()
+	{
+		// Both sides are seq_cst, so either the last share sees sleeping or the waiter sees remaining reach 0
+		if (remaining.fetch_sub(1) != 1 || !sleeping.load()) return;
+		std::lock_guard<std::mutex> guard(lock);
+		done.notify_all();
+	}
+
+	void wait()
+	{
+		if (spinUntil([this]() { return remaining.load(std::memory_order_acquire) == 0; })) return;
+
+		std::unique_lock<std::mutex> guard(lock);
+		sleeping.store(true);
+		done.wait(guard, [this]() { return remaining.load() == 0; });
+		sleeping.store(false, std::memory_order_relaxed);
+	}
+};
+
+// The worker threads every solver in the process shares, so calls one after another don't start threads each time and
+// solvers running side by side don't each bring their own. Work comes in as jobs of several shares, any of which any
+// worker can run. Workers take the next share from whichever job has had the least turns for its priority, so
+// concurrent solvers take turns instead of the first one in keeping every worker busy.
+class workerPool
+{
+public:
+	// Runs on a worker thread, with which of its job's shares it is (from 0) and that thread's generator
+	using share = std::function<void(int, randomGenerator&)>;
+
+private:
+	struct job
+	{
+		share work;
+		int shares;
+		int sharesLeft;
+		int priority;
+		double pass;	// stride scheduling: the job with the lowest pass goes next, and each share started adds 1/priority
+	};
+
+	int threadCount;
+	std::vector<std::shared_ptr<job>> jobs;	// those with shares left to start
+	std::atomic<int> sharesQueued;	// so idle workers can watch for work without the lock
+	double currentPass;	// where new jobs start, so one that's just arrived doesn't get every share until it catches up
+	std::mutex lock;
+	std::condition_variable jobAdded;
+
+	workerPool();
+	void workerMain();
+
+public:
+	workerPool(const workerPool&) = delete;
+	workerPool& operator=(const workerPool&) = delete;
+
+	static workerPool& instance();
+
+	// Grows the pool to at least count threads. It never shrinks, so it ends up as big as the most any solver asked for
+	void reserve(int count);
+
+	// Queues shares runs of work. A job with twice the priority of another gets twice the turns while both are waiting
+	void submit(share work, int shares, int priority);
+};
@@ -3,6 +3,11 @@
 #include <cstdint>
 #include <random>
 #include <mutex>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <limits>
 
 // implemented from http://xoshiro.di.unimi.it/splitmix64.c
 class splitmix64
@@ -147,5 +152,127 @@ private:
 	{
 		return generateInt(static_cast<T>(0), high);
 	}
+
+	// [0, 1)
+	inline double generateUnit()
+	{
+		return generateInt<uint32_t>(std::numeric_limits<uint32_t>::max() - 1) / 4294967295.0;
+	}
 };
 
+// Pre-drawn luck for common random numbers. Each tape holds a success roll and a condition roll (both 0-99) for every step,
+// so sim j of one sequence sees the same luck at each step as sim j of any other, and the two can be compared fairly
+class luckTapes
+{
+public:
+	enum rollKind
+	{
+		successRoll,
+		conditionRoll
+	};
+
+private:
+	int tapes;
+	int steps;
+	std::vector<uint8_t> rolls;	// [step][kind][tape], so a batch of tapes at one step sits together
+	std::array<float, 100> ratios[2];	// [kind][roll]: how much likelier the roll is from even rolls than from these tapes
+
+	static void pickRolls(uint8_t* out, size_t n, const std::array<double, 100>& cumulative, randomGenerator& rng)
+	{
+		for (size_t t = 0; t < n; ++t)
+		{
+			const double u = rng.generateUnit();
+			out[t] = static_cast<uint8_t>(std::min<std::ptrdiff_t>(99, std::upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin()));
+		}
+	}
+
+	void resize(int count, int length)
+	{
+		tapes = count;
+		steps = length;
+		rolls.resize(static_cast<size_t>(count) * length * 2);
+		ratios[successRoll].fill(1.f);
+		ratios[conditionRoll].fill(1.f);
+	}
+
+public:
+	luckTapes() :
+		tapes(0),
+		steps(0)
+	{
+		resize(0, 0);
+	}
+
+	void draw(int count, int length, randomGenerator& rng)
+	{
+		resize(count, length);
+		for (uint8_t& r : rolls)
+			r = static_cast<uint8_t>(rng.generateInt(99));
+	}
+
+	// Within each block, every other tape mirrors the success rolls of the one before it, so good luck on one is bad luck
+	// on the next. Condition rolls aren't mirrored: conditionByRoll isn't in any order, so that would just be more noise
+	void drawAntithetic(int count, int length, int block, randomGenerator& rng)
+	{
+		draw(count, length, rng);
+		for (size_t row = successRoll * tapes; row < rolls.size(); row += 2 * tapes)
+			for (int first = 0; first < tapes; first += block)
+				for (int t = first + 1; t < std::min(first + block, tapes); t += 2)
+					rolls[row + t] = static_cast<uint8_t>(99 - rolls[row + t - 1]);
+	}
+
+	// Within each block, every step's rolls are spread evenly over 0-99 and then shuffled (a Latin hypercube),
+	// so the block sees each condition and each roll's success about as often as their chances say
+	void drawStratified(int count, int length, int block, randomGenerator& rng)
+	{
+		resize(count, length);
+		for (size_t row = 0; row < rolls.size(); row += tapes)
+			for (int first = 0; first < tapes; first += block)
+			{
+				const int n = std::min(block, tapes - first);
+				uint8_t* const out = &rolls[row + first];
+				for (int t = 0; t < n; ++t)
+					out[t] = static_cast<uint8_t>((t * 100 + rng.generateInt(99)) / n);
+				for (int t = n - 1; t > 0; --t)
+					std::swap(out[t], out[rng.generateInt(t)]);
+			}
+	}
+
+	// Draws each kind of roll with the given chances instead of evenly (importance sampling). A sim's result is then
+	// worth the product of ratio() over the rolls it used. Each array must sum to 1
+	void drawWeighted(int count, int length, const std::array<double, 100>& successChances, const std::array<double, 100>& conditionChances, randomGenerator& rng)
+	{
+		resize(count, length);
+		std::array<double, 100> successCumulative, conditionCumulative;
+		std::partial_sum(successChances.begin(), successChances.end(), successCumulative.begin());
+		std::partial_sum(conditionChances.begin(), conditionChances.end(), conditionCumulative.begin());
+		for (size_t row = 0; row < rolls.size(); row += 2 * static_cast<size_t>(tapes))
+		{
+			pickRolls(&rolls[row + successRoll * tapes], tapes, successCumulative, rng);
+			pickRolls(&rolls[row + conditionRoll * tapes], tapes, conditionCumulative, rng);
+		}
+		for (int roll = 0; roll < 100; ++roll)
+		{
+			ratios[successRoll][roll] = static_cast<float>(0.01 / successChances[roll]);
+			ratios[conditionRoll][roll] = static_cast<float>(0.01 / conditionChances[roll]);
+		}
+	}
+
+	int count() const { return tapes; }
+	int length() const { return steps; }
+
+	// Steps past the end of the tapes reuse the last step's rolls
+	const uint8_t* at(int step, rollKind kind) const
+	{
+		return &rolls[(static_cast<size_t>(std::min(step, steps - 1)) * 2 + kind) * tapes];
+	}
+
+	int roll(int tape, int step, rollKind kind) const
+	{
+		return at(step, kind)[tape];
+	}
+
+	// All 1 unless the tapes came from drawWeighted
+	const float* ratioTable(rollKind kind) const { return ratios[kind].data(); }
+	float ratio(rollKind kind, int roll) const { return ratios[kind][roll]; }
+};
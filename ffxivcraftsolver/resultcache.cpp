@@ -0,0 +1,257 @@
+#include <cassert>
+#include <cstring>
+#include "resultcache.h"
+#include "sequencekey.h"
+#include "mappedfile.h"
+
+using namespace std;
+
+namespace
+{
+	// The start of a cache file. The clock hands follow, one byte for each bucket padded to a whole line, then the entries
+	struct fileHeader
+	{
+		char magic[8];
+		uint32_t format;
+		uint32_t entrySize;
+		uint64_t bucketCount;
+		char padding[40];
+	};
+	static_assert(sizeof(fileHeader) == 64, "entries start a line after the hands");
+
+	const char fileMagic[8] = "ATCACHE";
+	// Bump when the keys or what's stored change, so old files are turned away instead of giving wrong answers
+	constexpr uint32_t fileFormat = 1;
+
+	size_t handsSize(size_t bucketCount)
+	{
+		return (bucketCount + 63) / 64 * 64;
+	}
+}
+
+resultCache::resultCache(size_t buckets, entry* e, atomic<uint8_t>* h, unique_ptr<mappedFile> f) :
+	bucketCount(buckets),
+	entries(e),
+	hands(h),
+	file(move(f))
+{
+}
+
+resultCache::resultCache(int maxSize) :
+	resultCache(maxSize > 0 ? (static_cast<size_t>(maxSize) + bucketSize - 1) / bucketSize : 0, nullptr, nullptr, nullptr)
+{
+	ownEntries.reset(new entry[bucketCount * bucketSize]());
+	ownHands.reset(new atomic<uint8_t>[bucketCount]());
+	entries = ownEntries.get();
+	hands = ownHands.get();
+}
+
+// Here, where mappedFile is complete
+resultCache::~resultCache() = default;
+
+unique_ptr<resultCache> resultCache::openFile(const string& path, int maxSize)
+{
+	// Other processes share the entries, which only works if the atomics are really just the memory
+	if (!atomic<uint64_t>().is_lock_free() || !atomic<uint32_t>().is_lock_free() || !atomic<uint8_t>().is_lock_free())
+		return nullptr;
+
+	// There would be no room in a new file, so there's no looking for one
+	if (maxSize <= 0) return nullptr;
+
+	const size_t wanted = (static_cast<size_t>(maxSize) + bucketSize - 1) / bucketSize;
+	size_t buckets = wanted;
+	unique_ptr<mappedFile> mapped(new mappedFile);
+	const bool opened = mapped->open(path, sizeof(fileHeader) + handsSize(wanted) + wanted * bucketSize * sizeof(entry),
+		[&buckets](char* data, size_t length, bool created, bool alone)
+		{
+			fileHeader header;
+			if (created)
+			{
+				header = {};
+				memcpy(header.magic, fileMagic, sizeof(header.magic));
+				header.format = fileFormat;
+				header.entrySize = sizeof(entry);
+				header.bucketCount = buckets;
+				memcpy(data, &header, sizeof(header));
+				return true;
+			}
+
+			if (length < sizeof(header)) return false;
+			memcpy(&header, data, sizeof(header));
+			if (memcmp(header.magic, fileMagic, sizeof(header.magic)) != 0 || header.format != fileFormat ||
+				header.entrySize != sizeof(entry) || header.bucketCount == 0)
+				return false;
+			buckets = static_cast<size_t>(header.bucketCount);
+			if (length < sizeof(header) + handsSize(buckets) + buckets * bucketSize * sizeof(entry)) return false;
+
+			// With nobody else using the file, an entry still odd was left that way by a run that died writing it.
+			// Nothing else would ever make it even again, so every lookup would miss it and every writer pass it by
+			if (alone)
+			{
+				entry* const e = reinterpret_cast<entry*>(data + sizeof(fileHeader) + handsSize(buckets));
+				for (size_t i = 0; i < buckets * bucketSize; ++i)
+				{
+					const uint32_t version = e[i].version.load(memory_order_relaxed);
+					if ((version & 1) == 0) continue;
+					e[i].fingerprint.store(0, memory_order_relaxed);
+					e[i].referenced.store(0, memory_order_relaxed);
+					e[i].version.store(version + 1, memory_order_relaxed);
+				}
+			}
+			return true;
+		});
+	if (!opened) return nullptr;
+
+	char* const data = mapped->data();
+	auto h = reinterpret_cast<atomic<uint8_t>*>(data + sizeof(fileHeader));
+	auto e = reinterpret_cast<entry*>(data + sizeof(fileHeader) + handsSize(buckets));
+	return unique_ptr<resultCache>(new resultCache(buckets, e, h, move(mapped)));
+}
+
+uint64_t resultCache::fingerprintOf(uint64_t state, const craft::sequenceType& sequence)
+{
+	// 0 marks an empty entry
+	const uint64_t fingerprint = sequenceKey(sequence).fingerprint() ^ state;
+	return fingerprint != 0 ? fingerprint : 1;
+}
+
+resultCache::entry* resultCache::bucketOf(uint64_t fingerprint) const
+{
+	// The top half of the fingerprint scaled down to the bucket count, which saves a division
+	return &entries[((fingerprint >> 32) * bucketCount >> 32) * bucketSize];
+}
+
+bool resultCache::lookup(uint64_t state, const craft::sequenceType& sequence, int simulations, solver::netResult& out, int& stored) const
+{
+	if (bucketCount == 0 || sequence.empty()) return false;
+
+	const uint64_t fingerprint = fingerprintOf(state, sequence);
+	entry* const bucket = bucketOf(fingerprint);
+	for (entry* e = bucket; e != bucket + bucketSize; ++e)
+	{
+		const uint32_t version = e->version.load(memory_order_acquire);
+		if (e->fingerprint.load(memory_order_relaxed) != fingerprint) continue;
+
+		uint64_t words[resultWords];
+		for (int i = 0; i < resultWords; ++i)
+			words[i] = e->result[i].load(memory_order_relaxed);
+		// If the version's changed (or was odd), the words could be half one result and half another
+		atomic_thread_fence(memory_order_acquire);
+		if ((version & 1) != 0 || e->version.load(memory_order_relaxed) != version) return false;
+
+		storedResult result;
+		memcpy(&result, words, sizeof(result));
+		if (result.simulations < simulations || result.simulations <= 0) return false;
+
+		auto scale = [&result, simulations](int64_t sum)
+			{ return static_cast<int>((sum * simulations + result.simulations / 2) / result.simulations); };
+		out = {};
+		out.successes = scale(result.successes);
+		out.progress = scale(result.progress);
+		out.quality = scale(result.quality);
+		out.hqPercent = scale(result.goal);
+		out.steps = scale(result.steps);
+		out.invalidActions = scale(result.invalidActions);
+		out.firstInvalid = result.firstInvalid != 0;
+		out.simulations = simulations;
+		stored = result.simulations;
+
+		if (!e->referenced.load(memory_order_relaxed))
+			e->referenced.store(1, memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void resultCache::insert(uint64_t fingerprint, const solver::netResult& result)
+{
+	storedResult adding = {};
+	adding.progress = result.progress;
+	adding.quality = result.quality;
+	adding.goal = result.hqPercent;
+	adding.successes = result.successes;
+	adding.steps = result.steps;
+	adding.invalidActions = result.invalidActions;
+	adding.firstInvalid = result.firstInvalid;
+	adding.simulations = result.simulations;
+
+	entry* const bucket = bucketOf(fingerprint);
+	entry* target = nullptr;
+	bool adds = false;
+	for (entry* e = bucket; e != bucket + bucketSize; ++e)
+	{
+		const uint64_t existing = e->fingerprint.load(memory_order_relaxed);
+		if (existing == fingerprint)
+		{
+			target = e;
+			adds = true;
+			break;
+		}
+		if (existing == 0 && target == nullptr) target = e;
+	}
+
+	// Sweep the hand round, giving each used entry one more pass, until it finds one that hasn't been.
+	// Lookups elsewhere can keep setting them again, so it gives up after a couple of times round
+	atomic<uint8_t>& hand = hands[(bucket - entries) / bucketSize];
+	for (int swept = 0; target == nullptr && swept < 2 * bucketSize; ++swept)
+	{
+		const uint8_t h = hand.load(memory_order_relaxed) % bucketSize;
+		hand.store((h + 1) % bucketSize, memory_order_relaxed);
+		entry& e = bucket[h];
+		if (e.referenced.load(memory_order_relaxed))
+			e.referenced.store(0, memory_order_relaxed);
+		else
+			target = &e;
+	}
+	if (target == nullptr) return;
+
+	// Take the entry by making its version odd. If another writer has it, this result just doesn't get in
+	uint32_t version = target->version.load(memory_order_relaxed);
+	if ((version & 1) != 0 || !target->version.compare_exchange_strong(version, version + 1, memory_order_acquire, memory_order_relaxed))
+		return;
+	atomic_thread_fence(memory_order_release);
+
+	// The entry could have been given to another sequence since the search
+	if (adds && target->fingerprint.load(memory_order_relaxed) == fingerprint)
+	{
+		uint64_t words[resultWords];
+		for (int i = 0; i < resultWords; ++i)
+			words[i] = target->result[i].load(memory_order_relaxed);
+		storedResult stored;
+		memcpy(&stored, words, sizeof(stored));
+		if (stored.simulations < maxStoredSimulations)
+		{
+			stored.progress += adding.progress;
+			stored.quality += adding.quality;
+			stored.goal += adding.goal;
+			stored.successes += adding.successes;
+			stored.steps += adding.steps;
+			stored.invalidActions += adding.invalidActions;
+			stored.firstInvalid |= adding.firstInvalid;
+			stored.simulations += adding.simulations;
+		}
+		adding = stored;
+	}
+
+	uint64_t words[resultWords];
+	memcpy(words, &adding, sizeof(adding));
+	target->fingerprint.store(fingerprint, memory_order_relaxed);
+	for (int i = 0; i < resultWords; ++i)
+		target->result[i].store(words[i], memory_order_relaxed);
+	target->version.store(version + 2, memory_order_release);
+	// New entries get a pass, like the front of an LRU list
+	target->referenced.store(1, memory_order_relaxed);
+}
+
+void resultCache::populateCache(uint64_t state, const vector<solver::trial>& input)
+{
+	for (const auto& t : input)
+		if (t.simulated) add(state, t.sequence, t.outcome);
+}
+
+void resultCache::add(uint64_t state, const craft::sequenceType& sequence, const solver::netResult& result)
+{
+	// Actual empty sequences won't get cached, but that's for the best anyways.
+	if (bucketCount == 0 || sequence.empty() || result.simulations <= 0) return;
+	insert(fingerprintOf(state, sequence), result);
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "craft.h"
+#include "solver.h"
+
+class mappedFile;
+
+// The results of sequences already simulated, so a generation doesn't simulate them again. A fixed table of sequence
+// fingerprints and their results, in buckets of a few entries: a sequence only ever goes in the bucket its fingerprint
+// picks, pushing out whichever entry there the bucket's clock hand finds unused since it last came round.
+// Entries are keyed by the starting state's fingerprint as well as the sequence, so results from one solve still hold
+// for the next that starts from the same state, and those from other states just take up room until they're pushed out.
+// Each entry keeps sums over however many sims it's been given, and simulating a sequence again adds to them.
+// Any number of threads can look things up while others add to it, without locks. Each entry has a version that's
+// odd while it's being written, and a lookup that catches an entry mid-write just counts as a miss. Writers take an
+// entry by making its version odd themselves, and one that finds it already taken leaves its result out.
+// The table can live in a file instead, which any number of processes can have open at once. A process that dies
+// mid-write leaves that entry odd: every run sharing the file with it then misses the entry, until one opens the file
+// with nobody else using it and clears it.
+class resultCache
+{
+public:
+	static constexpr int bucketSize = 4;
+	// An entry stops adding sims past this, so its sums can't overflow
+	static constexpr int maxStoredSimulations = 1 << 20;
+
+private:
+	// A netResult, with room for sums over many more sims
+	struct storedResult
+	{
+		int64_t progress;
+		int64_t quality;
+		int64_t goal;	// whichever of netResult's union the goal uses
+		int32_t successes;
+		int32_t steps;
+		int32_t invalidActions;
+		int32_t firstInvalid;
+		int32_t simulations;
+		int32_t padding;
+	};
+	static constexpr int resultWords = sizeof(storedResult) / sizeof(uint64_t);
+	static_assert(sizeof(storedResult) % sizeof(uint64_t) == 0, "results are copied into the table word by word");
+
+	struct entry
+	{
+		std::atomic<uint32_t> version;
+		std::atomic<uint8_t> referenced;	// set by hits, cleared as the clock hand passes
+		std::atomic<uint64_t> fingerprint;	// 0 if empty
+		std::atomic<uint64_t> result[resultWords];
+	};
+	static_assert(sizeof(entry) == 64, "the file format depends on the entry size");
+
+	size_t bucketCount;
+	entry* entries;
+	std::atomic<uint8_t>* hands;	// one for each bucket
+	// Where entries and hands point into: either the heap or a mapped file
+	std::unique_ptr<entry[]> ownEntries;
+	std::unique_ptr<std::atomic<uint8_t>[]> ownHands;
+	std::unique_ptr<mappedFile> file;
+
+	static uint64_t fingerprintOf(uint64_t state, const craft::sequenceType& sequence);
+	entry* bucketOf(uint64_t fingerprint) const;
+	void insert(uint64_t fingerprint, const solver::netResult& result);
+
+	resultCache(size_t buckets, entry* e, std::atomic<uint8_t>* h, std::unique_ptr<mappedFile> f);
+
+public:
+	explicit resultCache(int maxSize);
+	resultCache() :
+		resultCache(0)
+	{}
+	resultCache(const resultCache&) = delete;
+	resultCache& operator=(const resultCache&) = delete;
+	~resultCache();
+
+	// A table kept in the file at path, made to hold maxSize results if it doesn't exist yet. An existing file keeps the
+	// size it was made with. nullptr if maxSize isn't positive, or the file can't be opened or isn't a cache made by this version
+	static std::unique_ptr<resultCache> openFile(const std::string& path, int maxSize);
+
+	// Safe from any number of threads, alongside populateCache. Finds a sequence with at least simulations sims,
+	// and gives its sums scaled to that many, along with how many it really has
+	bool lookup(uint64_t state, const craft::sequenceType& sequence, int simulations, solver::netResult& out, int& stored) const;
+	// Adds the results of the trials that were simulated. Safe from any number of threads and processes, alongside lookup
+	void populateCache(uint64_t state, const std::vector<solver::trial>& input);
+	// Adds one sequence's results, as populateCache does each trial's
+	void add(uint64_t state, const craft::sequenceType& sequence, const solver::netResult& result);
+
+	size_t capacity() const
+	{
+		return bucketCount * bucketSize;
+	}
+};
@@ -0,0 +1,57 @@
+#include <functional>
+#include "sequencekey.h"
+
+using namespace std;
+
+static_assert(static_cast<int>(actions::observe) < (1 << sequenceKey::bitsPerAction), "every action but invalid must pack");
+
+sequenceKey::sequenceKey(const craft::sequenceType& sequence) :
+	words{},
+	length(sequence.size())
+{
+	if (length > packedLength)
+	{
+		overflow = sequence;
+		return;
+	}
+
+	uint64_t* word = words;
+	int shift = 0;
+	for (actions a : sequence)
+	{
+		const uint64_t action = static_cast<uint64_t>(a);
+		if (action >= (1 << bitsPerAction))
+		{
+			fill(begin(words), end(words), 0);
+			overflow = sequence;
+			return;
+		}
+		*word |= action << shift;
+		shift += bitsPerAction;
+		if (shift == actionsPerWord * bitsPerAction)
+		{
+			shift = 0;
+			++word;
+		}
+	}
+}
+
+uint64_t sequenceKey::fingerprint() const
+{
+	// splitmix64's finalizer
+	auto mix = [](uint64_t z)
+		{
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			return z ^ (z >> 31);
+		};
+	// The words are multiplied independently so the CPU can do them side by side, and only the sum goes through the mixer
+	uint64_t output = mix(words[0] * 0x9e3779b97f4a7c15 + words[1] * 0xc2b2ae3d27d4eb4f +
+		words[2] * 0x165667b19e3779f9 + words[3] * 0xd6e8feb86659fd93 + length);
+	for (actions a : overflow)
+	{
+		// From Boost's hash_combine
+		output ^= std::hash<int>()(static_cast<int>(a)) + 0x9e3779b9 + (output << 6) + (output >> 2);
+	}
+	return output;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "craft.h"
+
+// A sequence packed into four words at 5 bits an action (12 to a word, so none straddle two), so hashing or comparing
+// one takes a few instructions instead of a walk over a vector. Sequences too long to pack, or holding an action that doesn't fit in 5 bits, are kept whole instead.
+// Either way, two keys are equal exactly when their sequences are
+class sequenceKey
+{
+public:
+	static constexpr int bitsPerAction = 5;
+	static constexpr int actionsPerWord = 64 / bitsPerAction;
+	static constexpr int packedWords = 4;
+	static constexpr size_t packedLength = packedWords * actionsPerWord;	// 48, well past any rotation the solver keeps
+
+	struct hasher
+	{
+		size_t operator()(const sequenceKey& key) const
+		{
+			return key.hash();
+		}
+	};
+
+private:
+	uint64_t words[packedWords];
+	size_t length;
+	std::vector<actions> overflow;	// the whole sequence, if it doesn't pack. left empty otherwise, so packing never allocates
+
+public:
+	sequenceKey() :
+		words{},
+		length(0)
+	{}
+	explicit sequenceKey(const craft::sequenceType& sequence);
+
+	bool operator==(const sequenceKey& other) const
+	{
+		return words[0] == other.words[0] && words[1] == other.words[1] && words[2] == other.words[2] && words[3] == other.words[3] &&
+			length == other.length && overflow == other.overflow;
+	}
+	bool operator!=(const sequenceKey& other) const
+	{
+		return !(*this == other);
+	}
+
+	// 64 bits, so a table can keep this instead of the key and all but never mistake one sequence for another
+	uint64_t fingerprint() const;
+	size_t hash() const
+	{
+		return static_cast<size_t>(fingerprint());
+	}
+};
@@ -2,139 +2,29 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
-#include <list>
 #include <deque>
-#include <set>
 #include <chrono>
+#include <cmath>
 #include "common.h"
 #include "solver.h"
 #include "craft.h"
+#include "batch.h"
+#include "exact.h"
 #include "random.h"
 #include "levels.h"
-
-// for thread priorities
-#if defined _WIN32
-#define NOMINMAX
-#include <windows.h>
-#endif
+#include "pool.h"
+#include "sequencekey.h"
+#include "resultcache.h"
 
 using namespace std;
 
 constexpr int generationRatio = 4;	// 1/n of trials will be used as the next generation's seeds
-
-template <typename T>
-class vectorHash
-{
-public:
-	size_t operator()(const vector<T>& in) const
-	{
-		size_t output = in.size();
-		for (T val : in)
-		{
-			// From Boost's hash_combine
-			output ^= hash<T>()(val) + 0x9e3779b9 + (output << 6) + (output >> 2);
-		}
-		return output;
-	}
-};
-
-class resultCache
-{
-private:
-	size_t maxCacheSize;
-	list<solver::trial> cacheData;
-	unordered_map <craft::sequenceType, list<solver::trial>::iterator, vectorHash<actions>> cacheHash;
-
-	int hits;
-	int misses;
-
-	void addToCache(solver::trial entry);
-	void moveToFront(list<solver::trial>::iterator it)
-	{
-		if (it != cacheData.begin())
-			cacheData.splice(cacheData.begin(), cacheData, it);
-	}
-	void removeLastEntry();
-public:
-	resultCache(int maxSize) :
-		maxCacheSize(maxSize),
-		hits(0),
-		misses(0)
-	{
-		if(maxCacheSize > 0)
-			cacheHash.reserve(maxCacheSize);
-	}
-	resultCache() :
-		resultCache(0)
-	{}
-	resultCache(const resultCache&) = delete;
-	bool operator=(const resultCache&) = delete;
-
-	// returns empty on a miss
-	solver::trial getCached(craft::sequenceType sequence, bool gatherStatistics);
-	void populateCache(const vector<solver::trial>& input);
-
-	int getHits() const
-	{
-		return hits;
-	}
-	int getMisses() const
-	{
-		return misses;
-	}
-};
-
-void resultCache::addToCache(solver::trial entry)
-{
-	if (entry.sequence.empty()) return;
-	entry.sequence.shrink_to_fit();
-	cacheData.push_front(entry);
-	auto it = cacheData.begin();
-	cacheHash.insert({ entry.sequence, it });
-	assert(cacheData.size() == cacheHash.size());
-}
-
-void resultCache::removeLastEntry()
-{
-	assert(!cacheData.empty() && !cacheHash.empty());
-	auto dataIt = std::prev(cacheData.end());
-	auto hashIt = cacheHash.find(dataIt->sequence);
-	assert(hashIt != cacheHash.end());
-	cacheHash.erase(hashIt);
-	cacheData.erase(dataIt);
-}
-
-solver::trial resultCache::getCached(craft::sequenceType sequence, bool gatherStatistics)
-{
-	auto it = cacheHash.find(sequence);
-	if (it != cacheHash.end())
-	{
-		if (gatherStatistics) hits++;
-		moveToFront(it->second);
-		return *(it->second);
-	}
-	else
-	{
-		if (gatherStatistics) misses++;
-		return solver::trial{};
-	}
-}
-
-void resultCache::populateCache(const vector<solver::trial>& input)
-{
-	if (maxCacheSize <= 0) return;
-	for (const auto& t : input)
-	{
-		// Make sure it's not already in the cache
-		// Actual empty sequences won't get cached, but that's for the best anyways.
-		// Has the side effect of moving these to the top.
-		if (!getCached(t.sequence, false).sequence.empty())
-			continue;
-		while (cacheHash.size() >= maxCacheSize)
-			removeLastEntry();
-		addToCache(t);
-	}
-}
+constexpr double racingRisk = 0.001;	// the chance each check has of retiring a trial that's not actually worse than the elite
+constexpr int multisimReplicates = 10;	// independent runs a multisim's standard errors are taken from
+constexpr double importanceBias = 3.0;	// how much likelier importance sampling makes the worst roll than the best
+constexpr size_t sequenceCapacity = 100;	// what each trial's sequence has room for from the start. atSolverResult can't hold longer anyway
+constexpr int survivorGenerations = 8;	// survivors stop getting more sims once they've had this many generations' worth
+constexpr int chunksPerShare = 8;	// roughly how many claims each worker makes of an order. more balances better at the end, fewer contend less
 
 class actionHistory
 {
@@ -193,7 +83,8 @@ public:
 	}
 };
 
-void workerMain(solver* solve);
+void workerPerformSimulations(solver* solve, solver::threadOrder order, int share, randomGenerator& rng);
+void workerPerformMutations(solver* solve, solver::threadOrder order, int share, randomGenerator& rng);
 
 const vector<actions> allActions = {
 	actions::basicSynth,
@@ -370,25 +261,36 @@ solver::solver(const crafterStats & c, const recipeStats & r, const craft::seque
 	crafter(c),
 	recipe(r),
 	goal(g),
-	initialState(iQ, c, r, nLock),
+	context(c, r, nLock),
+	initialState(iQ, context),
 	numberOfThreads(tCnt),
+	priority(1),
 	strat(strategy::standard),	// this and gatherStatistics not used for multisynth,
 	gatherStatistics(false),	// but it makes the compiler happy
+	exactEvaluation(false),
+	adaptiveSimulations(false),
+	commonRandomNumbers(false),
+	sampling(samplingMethod::random),
+	multisimErrors{},
+	multisimFailures{},
+	verifyCandidates(0),
+	verifySimulations(0),
 	offspringOfFittest(0.5),
 	trials(1),
-	simResults(1),
+	resultSlabs(tCnt, vector<netResult>(1)),
+	cacheSize(0),
+	cacheInFile(false),
 	cached(1, false),
 	sequenceCounters(1),
-	threadsDone(0)
+	sharesDone(make_shared<shareLatch>())
 {
 	assert(numberOfThreads > 0);
 
-	activeOrder.command = threadCommand::terminate;	// "terminate" doubles as start
 
 	trials[0].sequence = seed;
 	trials[0].outcome = netResult();
 
-	sequenceCounters[0].store(0, memory_order_relaxed);
+	sequenceCounters[0].claimed.store(0, memory_order_relaxed);
 }
 
 // Constructor for solve mode
@@ -403,26 +305,37 @@ solver::solver(const crafterStats& c,
 	crafter(c),
 	recipe(r),
 	goal(g),
-	initialState(iQ, c, r, nLock),
+	context(c, r, nLock),
+	initialState(iQ, context),
 	numberOfThreads(tCnt),
+	priority(1),
 	strat(s),
 	gatherStatistics(gS),
+	exactEvaluation(false),
+	adaptiveSimulations(false),
+	commonRandomNumbers(false),
+	sampling(samplingMethod::random),
+	multisimErrors{},
+	multisimFailures{},
+	verifyCandidates(0),
+	verifySimulations(0),
 	offspringOfFittest(selectionPressure),
 	trials(population),
-	simResults(population),
+	resultSlabs(tCnt, vector<netResult>(population)),
+	cacheSize(0),
+	cacheInFile(false),
 	cached(population, false),
 	sequenceCounters(population),
 	availableActions(getAvailable(c, r, uC && !nLock, true)),
 	availableWithoutFirst(getAvailable(c, r, uC && !nLock, false)),
-	threadsDone(0)
+	sharesDone(make_shared<shareLatch>())
 {
 	assert(numberOfThreads > 0);
 	assert(offspringOfFittest > 1.0 && offspringOfFittest <= 2.0);
 
 	setSelections(population);
+	reserveGenerations();
 
-	activeOrder.command = threadCommand::terminate;
-	
 	resetSeeds(seed);
 }
 
@@ -437,48 +350,316 @@ solver::solver(const crafterStats& c,
 	crafter(c),
 	recipe(r),
 	goal(g),
+	context(iS.getContext()),
 	initialState(iS),
 	numberOfThreads(tCnt),
+	priority(1),
 	strat(s),
 	gatherStatistics(false),
+	exactEvaluation(false),
+	adaptiveSimulations(false),
+	commonRandomNumbers(false),
+	sampling(samplingMethod::random),
+	multisimErrors{},
+	multisimFailures{},
+	verifyCandidates(0),
+	verifySimulations(0),
 	offspringOfFittest(selectionPressure),
 	trials(population),
-	simResults(population),
+	resultSlabs(tCnt, vector<netResult>(population)),
+	cacheSize(0),
+	cacheInFile(false),
 	cached(population, false),
 	sequenceCounters(population),
 	availableActions(getAvailable(c, r, true, initialState.getStep() == 1)),
 	availableWithoutFirst(getAvailable(c, r, true, false)),
-	threadsDone(0)
+	sharesDone(make_shared<shareLatch>())
 {
 	assert(numberOfThreads > 0);
 	assert(offspringOfFittest > 1.0 && offspringOfFittest <= 2.0);
 
-	setSelections(population);
+	initialState.setContext(context);
 
-	activeOrder.command = threadCommand::terminate;
+	setSelections(population);
+	reserveGenerations();
 
 	resetSeeds(seed);
 }
 
+// Here, where resultCache is complete
+solver::~solver() = default;
+
+bool solver::setCacheFile(const string& path, int maxSize)
+{
+	unique_ptr<resultCache> opened = resultCache::openFile(path, maxSize);
+	if (!opened) return false;
+	cache = move(opened);
+	cacheInFile = true;
+	return true;
+}
+
+// Sizes mutated to match trials, and gives every sequence in both room for sequenceCapacity actions. From then on,
+// children are copied into the places of the generation before last, and generations only ever swap
+void solver::reserveGenerations()
+{
+	mutated.resize(trials.size());
+	for (vector<trial>* generation : { &trials, &mutated })
+		for (trial& t : *generation)
+			t.sequence.reserve(sequenceCapacity);
+
+	// At most half full, so probes stay short
+	originals.resize(trials.size());
+	earlierResults.resize(trials.size());
+	earlierSimulations.resize(trials.size());
+	size_t tableSize = 1;
+	while (tableSize < 2 * trials.size()) tableSize *= 2;
+	firstCopies.resize(tableSize);
+}
+
+// Points each trial at the first one with the same sequence, returning how many different sequences there are
+int solver::findCopies()
+{
+	const size_t mask = firstCopies.size() - 1;
+	fill(firstCopies.begin(), firstCopies.end(), -1);
+	int different = 0;
+	for (size_t i = 0; i < trials.size(); ++i)
+	{
+		const craft::sequenceType& sequence = trials[i].sequence;
+		size_t slot = sequenceKey(sequence).hash() & mask;
+		while (firstCopies[slot] >= 0 && trials[firstCopies[slot]].sequence != sequence)
+			slot = (slot + 1) & mask;
+		if (firstCopies[slot] < 0)
+		{
+			firstCopies[slot] = static_cast<int>(i);
+			different++;
+		}
+		originals[i] = firstCopies[slot];
+	}
+	return different;
+}
+
+// Survivors are the trials found in the cache, the elite among them. Those still in the running get another generation's
+// worth of sims, until they've had survivorGenerations' worth, so a lucky first estimate can't hold on to the top and the
+// contenders' results get surer. Without the cache every trial gets new sims each generation anyways
+void solver::pickSurvivors(int simulationsPerTrial, const netResult& lastElite, bool coalesceCopies)
+{
+	fill(earlierSimulations.begin(), earlierSimulations.end(), 0);
+	if (lastElite.simulations == 0) return;
+
+	for (size_t i = 0; i < trials.size(); ++i)
+	{
+		trial& t = trials[i];
+		// Under common random numbers, copies of a survivor keep what they found rather than run the same sims again
+		if (cached[i] != 1 || t.pooledSimulations >= survivorGenerations * simulationsPerTrial ||
+			(coalesceCopies && originals[i] != static_cast<int>(i)) || clearlyWorse(t.outcome, lastElite))
+			continue;
+		earlierResults[i] = t.outcome;
+		earlierSimulations[i] = t.pooledSimulations;
+		t.outcome = {};
+		cached[i] = 0;
+	}
+}
+
+// The average of two results at the same scale, weighted by how many sims each is really over
+solver::netResult poolResults(const solver::netResult& a, int aSims, const solver::netResult& b, int bSims)
+{
+	const long long total = max(aSims + bSims, 1);
+	auto pool = [aSims, bSims, total](int x, int y)
+		{ return static_cast<int>((static_cast<long long>(x) * aSims + static_cast<long long>(y) * bSims + total / 2) / total); };
+	solver::netResult pooled = a;
+	pooled.successes = pool(a.successes, b.successes);
+	pooled.progress = pool(a.progress, b.progress);
+	pooled.quality = pool(a.quality, b.quality);
+	pooled.hqPercent = pool(a.hqPercent, b.hqPercent);	// whichever the goal uses
+	pooled.steps = pool(a.steps, b.steps);
+	pooled.invalidActions = pool(a.invalidActions, b.invalidActions);
+	pooled.firstInvalid = a.firstInvalid || b.firstInvalid;
+	return pooled;
+}
+
+// The same averages as result, as sums over simulations sims
+solver::netResult scaleResult(const solver::netResult& result, int simulations)
+{
+	auto scale = [&result, simulations](int sum)
+		{ return static_cast<int>((static_cast<long long>(sum) * simulations + result.simulations / 2) / result.simulations); };
+	solver::netResult scaled = result;
+	scaled.successes = scale(result.successes);
+	scaled.progress = scale(result.progress);
+	scaled.quality = scale(result.quality);
+	scaled.hqPercent = scale(result.hqPercent);	// whichever the goal uses
+	scaled.steps = scale(result.steps);
+	scaled.invalidActions = scale(result.invalidActions);
+	scaled.simulations = simulations;
+	return scaled;
+}
+
+// Adds the survivors' new sims to the cache on their own, then pools them with what they had before
+void solver::poolSurvivors(uint64_t cacheState)
+{
+	for (size_t i = 0; i < trials.size(); ++i)
+	{
+		if (earlierSimulations[i] == 0) continue;
+		trial& t = trials[i];
+		if (cache && t.simulated) cache->add(cacheState, t.sequence, t.outcome);
+		t.simulated = false;	// so populateCache doesn't add the new sims again, pooled with the old
+		t.outcome = poolResults(earlierResults[i], earlierSimulations[i], t.outcome, t.pooledSimulations);
+		t.pooledSimulations += earlierSimulations[i];
+	}
+}
+
 void solver::resetSeeds(const craft::sequenceType& seed)
 {
 	for_each(trials.begin(), trials.end(),
-		[&seed](trial& t) { t.sequence = seed; });
+		[&seed](trial& t) { t.sequence = seed; t.prefix = {}; });
 }
 
 void solver::incrementSeeds(int amount)
 {
 	if (amount < 0) amount = 0;
 	for (auto& t : trials)
+	{
 		t.sequence.erase(t.sequence.begin(), t.sequence.begin() + (min(amount, static_cast<int>(t.sequence.size()))));
+		t.prefix = {};
+	}
+}
+
+int goalSum(const solver::netResult& result, goalType goal)
+{
+	switch (goal)
+	{
+	case goalType::hq:
+		return result.hqPercent;
+	case goalType::maxQuality:
+		return result.quality;
+	case goalType::collectability:
+		return result.collectableGoalsHit;
+	case goalType::points:
+		return result.points;
+	}
+	return 0;
+}
+
+// Of the mean of the replicates' averages. 0 with fewer than two, which is right for a decided or exactly evaluated trial
+double standardError(const vector<double>& averages)
+{
+	const size_t n = averages.size();
+	if (n < 2) return 0;
+	double mean = 0;
+	for (double a : averages) mean += a;
+	mean /= n;
+	double squares = 0;
+	for (double a : averages) squares += (a - mean) * (a - mean);
+	return sqrt(squares / (n - 1) / n);
+}
+
+int solver::tapeLength() const
+{
+	// A trial can't take more steps than it has actions
+	size_t longest = 0;
+	for (const trial& t : trials)
+		longest = max(longest, t.sequence.size());
+	return initialState.getStep() + static_cast<int>(longest) + 1;
+}
+
+vector<solver::standardErrors> solver::runReplicates(threadOrder& orders, int simulationsPerTrial, size_t count)
+{
+	// The sims run as independent replicates, one block of tapes each, one after another
+	const int replicates = min(multisimReplicates, simulationsPerTrial);
+	const int block = (simulationsPerTrial + replicates - 1) / replicates;
+	orders.luck = nullptr;
+	if (sampling == samplingMethod::antithetic)
+	{
+		luck.drawAntithetic(simulationsPerTrial, tapeLength(), block, luckSource);
+		orders.luck = &luck;
+	}
+	else if (sampling == samplingMethod::stratified)
+	{
+		luck.drawStratified(simulationsPerTrial, tapeLength(), block, luckSource);
+		orders.luck = &luck;
+	}
+	else if (commonRandomNumbers)
+	{
+		luck.draw(simulationsPerTrial, tapeLength(), luckSource);
+		orders.luck = &luck;
+	}
+
+	// A decided or exactly evaluated trial gets every sim in the first replicate, and sits out the rest
+	vector<char> finished(*orders.cached);
+	vector<char> const * const ordered = orders.cached;
+	orders.cached = &finished;
+	vector<vector<double>> successRates(count), goalAverages(count);
+	vector<netResult> before(count);
+	for (int done = 0; done < simulationsPerTrial; done += block)
+	{
+		for (size_t i = 0; i < count; ++i)
+			before[i] = trials[i].outcome;
+		orders.numberOfSimulations = min(block, simulationsPerTrial - done);
+		setOrder(orders);
+		waitOnSimsDone();
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const netResult& after = trials[i].outcome;
+			const int sims = after.simulations - before[i].simulations;
+			if (after.simulations >= simulationsPerTrial) finished[i] = true;
+			if (sims == 0) continue;
+			successRates[i].push_back(static_cast<double>(after.successes - before[i].successes) / sims);
+			goalAverages[i].push_back(static_cast<double>(goalSum(after, goal) - goalSum(before[i], goal)) / sims);
+		}
+	}
+	orders.cached = ordered;
+
+	vector<standardErrors> errors(count);
+	for (size_t i = 0; i < count; ++i)
+		errors[i] = { standardError(successRates[i]), standardError(goalAverages[i]) };
+	return errors;
+}
+
+void solver::estimateFailures(threadOrder& orders, int simulationsPerTrial)
+{
+	// Lean every roll toward failing: success rolls toward 99, and condition rolls away from the ones that help
+	// progress, durability or CP. Without any of those (i.e. not expert) the conditions don't lean at all
+	array<double, 100> successChances, conditionChances;
+	double successTotal = 0, conditionTotal = 0;
+	for (int roll = 0; roll < 100; ++roll)
+	{
+		successChances[roll] = pow(importanceBias, roll / 99.0);
+		const craft::condition c = context.conditionByRoll[roll];
+		const bool helps = c == craft::condition::centered || c == craft::condition::sturdy || c == craft::condition::pliant ||
+			c == craft::condition::malleable || c == craft::condition::primed;
+		conditionChances[roll] = helps ? 1.0 : importanceBias;
+		successTotal += successChances[roll];
+		conditionTotal += conditionChances[roll];
+	}
+	for (int roll = 0; roll < 100; ++roll)
+	{
+		successChances[roll] /= successTotal;
+		conditionChances[roll] /= conditionTotal;
+	}
+	luck.drawWeighted(simulationsPerTrial, tapeLength(), successChances, conditionChances, luckSource);
+
+	vector<double> weightedFailures(simulationsPerTrial, 0.0);
+	orders.luck = &luck;
+	orders.weightedFailures = weightedFailures.data();
+	orders.numberOfSimulations = simulationsPerTrial;
+	setOrder(orders);
+	waitOnSimsDone();
+	orders.weightedFailures = nullptr;
+
+	double sum = 0, squares = 0;
+	for (double w : weightedFailures)
+	{
+		sum += w;
+		squares += w * w;
+	}
+	const double n = simulationsPerTrial;
+	multisimFailures.rate = sum / n;
+	multisimFailures.standardError = n > 1 ? sqrt(max(0.0, (squares - sum * sum / n) / (n - 1)) / n) : 0;
 }
 
 solver::trial solver::executeMultisim(int simulationsPerTrial)
 {
-	vector<thread> threads;
-	
-	for (int i = 0; i < numberOfThreads; i++)
-		threads.emplace_back(workerMain, this);
+	workerPool::instance().reserve(numberOfThreads - 1);
 
 	threadOrder orders = {};
 	orders.command = threadCommand::simulate;
@@ -487,17 +668,28 @@ solver::trial solver::executeMultisim(int simulationsPerTrial)
 	orders.cached = &cached;
 	orders.crafter = &crafter;
 	orders.recipe = &recipe;
-	orders.numberOfSimulations = simulationsPerTrial;
+	orders.fullSimulations = simulationsPerTrial;
 	orders.initialState = &initialState;
 	orders.goal = goal;
+	orders.exactEvaluation = exactEvaluation;
 
-	setOrder(orders);
-	waitOnSimsDone();
-	orders.command = threadCommand::terminate;
-	setOrder(orders);
+	// Only the first trial is returned, so that's all that needs simming
+	vector<char> skipped(trials.size(), true);
+	skipped[0] = false;
+	orders.cached = &skipped;
+	for (auto& t : trials)
+		t.outcome = {};
 
-	for (auto& t : threads)
-		t.join();
+	if (sampling == samplingMethod::importance)
+	{
+		estimateFailures(orders, simulationsPerTrial);
+		multisimErrors = {};
+	}
+	else
+	{
+		multisimErrors = runReplicates(orders, simulationsPerTrial, 1).front();
+		multisimFailures = {};
+	}
 
 	return trials[0];
 }
@@ -579,6 +771,107 @@ bool solver::compareResult(const solver::trial& a, const solver::trial& b, int s
 	return sequenceTime(a.sequence) < sequenceTime(b.sequence);
 }
 
+// True if the sims so far put result behind the elite on what the strategy ranks first, even allowing for the luck of both.
+// The allowance is Hoeffding's bound, which only needs the range of a single sim's value
+bool solver::clearlyWorse(const netResult& result, const netResult& elite) const
+{
+	auto allowance = [](int sims, double range) { return range * sqrt(log(2 / racingRisk) / (2.0 * sims)); };
+	auto behind = [&result, &elite, &allowance](double resultSum, double eliteSum, double range)
+	{
+		return resultSum / result.simulations + allowance(result.simulations, range) <
+			eliteSum / elite.simulations - allowance(elite.simulations, range);
+	};
+
+	const bool fewerSuccesses = behind(result.successes, elite.successes, 1);
+	if (strat == strategy::nqOnly) return fewerSuccesses;
+
+	bool goalBehind = false;
+	switch (goal)
+	{
+	case goalType::hq:
+		goalBehind = behind(result.hqPercent, elite.hqPercent, 100);
+		break;
+	case goalType::maxQuality:
+		goalBehind = behind(result.quality, elite.quality, recipe.nominalQuality);	// a sim can go over, but compareResult doesn't care much past it either
+		break;
+	case goalType::collectability:
+		goalBehind = behind(result.collectableGoalsHit, elite.collectableGoalsHit, 1);
+		break;
+	case goalType::points:
+		goalBehind = behind(result.points, elite.points, recipe.points.empty() ? 0 : recipe.points.back().second);
+		break;
+	}
+	if (strat == strategy::hqOrBust) return goalBehind;
+
+	// Successes come first, so the goal only settles it if there's no getting more successes than the elite
+	return fewerSuccesses || (elite.successes == elite.simulations && goalBehind);
+}
+
+int solver::simulateGeneration(threadOrder& orders, int simulationsPerTrial, const netResult& elite)
+{
+	orders.command = threadCommand::simulate;
+	orders.fullSimulations = simulationsPerTrial;
+	for (size_t i = 0; i < trials.size(); ++i)
+	{
+		trials[i].simulated = !cached[i];
+		if (!cached[i]) trials[i].pooledSimulations = simulationsPerTrial;
+	}
+
+	orders.luck = nullptr;
+	if (commonRandomNumbers)
+	{
+		luck.draw(simulationsPerTrial, tapeLength(), luckSource);
+		orders.luck = &luck;
+	}
+
+	if (!adaptiveSimulations || elite.simulations == 0)
+	{
+		orders.numberOfSimulations = simulationsPerTrial;
+		orders.cached = &cached;
+		setOrder(orders);
+		waitOnSimsDone();
+		return 0;
+	}
+
+	// Start everything off with a small round, then keep doubling for whatever's still in the running
+	vector<char> finished(cached);
+	orders.cached = &finished;
+	int done = 0;
+	for (int target = min(simulationsPerTrial, max(maxBatchLanes, simulationsPerTrial / 8)); ; target = min(simulationsPerTrial, target * 2))
+	{
+		orders.numberOfSimulations = target - done;
+		setOrder(orders);
+		waitOnSimsDone();
+		done = target;
+		if (done >= simulationsPerTrial) break;
+
+		bool anyLeft = false;
+		for (size_t i = 0; i < trials.size(); ++i)
+		{
+			if (finished[i]) continue;
+			// Decided and exactly evaluated trials have all their sims already
+			if (trials[i].outcome.simulations >= simulationsPerTrial || clearlyWorse(trials[i].outcome, elite))
+				finished[i] = true;
+			else anyLeft = true;
+		}
+		if (!anyLeft) break;
+	}
+	orders.cached = &cached;
+
+	// Scale the retired trials up so compareResult can weigh them against the rest
+	int saved = 0;
+	for (size_t i = 0; i < trials.size(); ++i)
+	{
+		netResult& outcome = trials[i].outcome;
+		if (cached[i] || outcome.simulations >= simulationsPerTrial || outcome.simulations == 0) continue;
+		saved += simulationsPerTrial - outcome.simulations;
+		trials[i].simulated = false;
+		trials[i].pooledSimulations = outcome.simulations;
+		outcome = scaleResult(outcome, simulationsPerTrial);
+	}
+	return saved;
+}
+
 void solver::setSelections(int population)
 {
 	static_assert(generationRatio > 0, "generationRatio must be positive");
@@ -588,84 +881,201 @@ void solver::setSelections(int population)
 	assert(population > 1);
 	populationSelections.clear();
 	populationSelections.reserve(population);
+	double total = 0;
 	for (int i = population - 1; i >= 0; --i)	// Go backwards since sorting was best-to-worst
-		populationSelections.push_back((2 - offspringOfFittest) / population +
-			2 * i * (offspringOfFittest - 1) / (population * (population - 1)));
+	{
+		total += (2 - offspringOfFittest) / population +
+			2 * i * (offspringOfFittest - 1) / (population * (population - 1));
+		populationSelections.push_back(total);
+	}
+	for (double& p : populationSelections)
+		p /= total;
 }
 
-solver::trial solver::executeSolver(int simulationsPerTrial, int generations, int generationWindow, int generationEarly, int maxCacheSize, solver::solverCallback callback)
+// Picks a parent from the front of the sorted trials, fitter ones likelier
+size_t solver::selectParent(randomGenerator& rng) const
+{
+	const auto picked = upper_bound(populationSelections.begin(), populationSelections.end(), rng.generateUnit());
+	return min(static_cast<size_t>(picked - populationSelections.begin()), populationSelections.size() - 1);
+}
+
+// Simulates the best few different sequences of ranked (the last generation, sorted at the front) again, verifySimulations
+// sims each, and puts whichever comes out best at the front of trials with its outcome scaled back to a generation's worth
+void solver::verifyBest(threadOrder& orders, const vector<trial>& ranked, int simulationsPerTrial, uint64_t cacheState)
 {
-	vector<thread> threads;
-	if(generations > 0)
-		for (int i = 0; i < numberOfThreads; i++)
-			threads.emplace_back(workerMain, this);
+	// Copies of the elite tend to crowd the top, so each sequence only counts once
+	const size_t sorted = min(ranked.size(), ranked.size() / generationRatio + 1);
+	size_t count = 0;
+	for (size_t i = 0; i < sorted && count < static_cast<size_t>(verifyCandidates); ++i)
+	{
+		const trial& t = ranked[i];
+		if (any_of(trials.begin(), trials.begin() + count, [&t](const trial& c) { return c.sequence == t.sequence; }))
+			continue;
+		trials[count] = t;
+		trials[count].outcome = {};
+		count++;
+	}
 
-	xorshift rng;
-	rng.seed(random_device()());
+	vector<char> skipped(trials.size(), true);
+	fill(skipped.begin(), skipped.begin() + count, false);
+	orders.command = threadCommand::simulate;
+	orders.trials = &trials;
+	orders.cached = &skipped;
+	orders.fullSimulations = verifySimulations;
+	orders.luck = nullptr;
+
+	// Where the exact evaluator can finish, there's no luck left to verify. It gets a candidate to a thread, and gives up
+	// after a replicate's worth of work, so one it can't do still has its sims split between the threads after
+	orders.exactEvaluation = true;
+	orders.exactOnly = true;
+	orders.numberOfSimulations = max(1, verifySimulations / multisimReplicates);
+	setOrder(orders);
+	waitOnSimsDone();
+	orders.exactEvaluation = false;
+	orders.exactOnly = false;
+	for (size_t i = 0; i < count; ++i)
+		if (trials[i].outcome.simulations >= verifySimulations) skipped[i] = true;
 
-	resultCache cache(maxCacheSize);
+	const vector<standardErrors> errors = runReplicates(orders, verifySimulations, count);
+	orders.cached = &cached;
+	orders.exactEvaluation = exactEvaluation;
+
+	verified.clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (cache) cache->add(cacheState, trials[i].sequence, trials[i].outcome);
+		verified.push_back({ trials[i], errors[i] });
+	}
+	// Ties stay in the generation's order
+	stable_sort(verified.begin(), verified.end(), [this](const verifiedCandidate& a, const verifiedCandidate& b)
+		{ return compareResult(a.candidate, b.candidate, verifySimulations, true); });
+
+	trial& best = trials.front();
+	best = verified.front().candidate;
+	best.outcome = scaleResult(best.outcome, simulationsPerTrial);
+	best.simulated = false;
+	best.pooledSimulations = verifySimulations;
+}
+
+solver::trial solver::executeSolver(int simulationsPerTrial, int generations, int generationWindow, int generationEarly, int maxCacheSize, solver::solverCallback callback)
+{
+	workerPool::instance().reserve(numberOfThreads - 1);
+
+	if (!cacheInFile)
+	{
+		if (maxCacheSize <= 0)
+			cache.reset();
+		else if (!cache || cacheSize != maxCacheSize)
+		{
+			cache.reset(new resultCache(maxCacheSize));
+			cacheSize = maxCacheSize;
+		}
+	}
+	// A file could have results from other crafters, recipes and goals. The sim count isn't part of it: entries know
+	// how many sims they have, and hold for any solve that wants as many or fewer
+	uint64_t cacheState = context.fingerprint();
+	for (uint64_t part : { initialState.fingerprint(), static_cast<uint64_t>(goal) })
+		cacheState = splitmix64(cacheState ^ part)();
 
 	threadOrder orders = {};
-	orders.command = threadCommand::terminate;
 	orders.counters = &sequenceCounters;
 	orders.cached = &cached;
 	orders.crafter = &crafter;
 	orders.recipe = &recipe;
 	orders.numberOfSimulations = simulationsPerTrial;
+	orders.fullSimulations = simulationsPerTrial;
 	orders.initialState = &initialState;
 	orders.goal = goal;
-
-	discrete_distribution<int> d(populationSelections.begin(), populationSelections.end());
+	orders.exactEvaluation = exactEvaluation;
 
 	actionHistory hist(generationWindow);
 
+	timings = {};
+	verified.clear();
+	bool lastRanked = false;	// mutated is the last generation, ranked, and all of it was simulated
+	auto phaseStart = chrono::steady_clock::now();
+	auto endPhase = [&phaseStart](double& total)
+		{
+			const auto now = chrono::steady_clock::now();
+			total += chrono::duration<double>(now - phaseStart).count();
+			phaseStart = now;
+		};
+
 	for (int gen = 0; gen < generations; gen++)
 	{
+		const netResult lastElite = gen > 0 ? trials.front().outcome : netResult{};	// the elite always goes first
 		for (auto& t : trials)
 			t.outcome = {};	
 		
-		// See if any of our prospective sequences already have their results already in the cache
-		if (maxCacheSize > 0)
+		// See if any of our prospective sequences already have their results already in the cache.
+		// The lookup only writes the trials' results, so the main thread can find the copies in the meantime
+		phaseStart = chrono::steady_clock::now();
+		// With common random numbers a copy would come out exactly the same as the first of its sequence, so it takes
+		// that one's result instead of being simulated. Otherwise its sims are as good as any other's, and it keeps them
+		const bool coalesceCopies = commonRandomNumbers;
+		int uniquePopulation = 0;
+		auto coalesce = [this, &uniquePopulation, coalesceCopies]()
+			{
+				if (gatherStatistics || coalesceCopies) uniquePopulation = findCopies();
+			};
+		if (cache)
+		{
+			orders.command = threadCommand::lookup;
+			orders.cache = cache.get();
+			orders.cacheState = cacheState;
+			setOrder(orders, coalesce);
+			waitOnSharesDone();
+		}
+		else
+		{
+			// The lookup would have cleared the last generation's copies
+			fill(cached.begin(), cached.end(), 0);
+			coalesce();
+		}
+
+		int cacheHits = 0;
+		int copySims = 0;
+		for (size_t i = 0; i < trials.size(); ++i)
 		{
-			for (size_t i = 0; i < trials.size(); ++i)
+			if (cached[i])
+				cacheHits++;
+			else if (coalesceCopies && originals[i] != static_cast<int>(i))
 			{
-				trial current = cache.getCached(trials[i].sequence, gatherStatistics);
-				bool currentCached = !current.sequence.empty();	// An empty sequence is never cached, so this test is okay
-				cached[i] = currentCached;
-				if (currentCached)
-					trials[i] = current;
+				cached[i] = copyOfEarlier;
+				copySims += simulationsPerTrial;
 			}
 		}
+		if (!gatherStatistics)
+		{
+			uniquePopulation = 0;
+			cacheHits = 0;
+			copySims = 0;
+		}
+		pickSurvivors(simulationsPerTrial, lastElite, coalesceCopies);
+		endPhase(timings.lookup);
 
 		orders.trials = &trials;
-		orders.command = threadCommand::simulate;
-		setOrder(orders);
-		waitOnSimsDone();
+		const int simsSaved = simulateGeneration(orders, simulationsPerTrial, lastElite);
+		poolSurvivors(cacheState);
+		for (size_t i = 0; i < trials.size(); ++i)
+			if (cached[i] == copyOfEarlier)
+			{
+				trials[i].outcome = trials[originals[i]].outcome;
+				trials[i].pooledSimulations = trials[originals[i]].pooledSimulations;
+			}
+		endPhase(timings.simulate);
 
 		auto compNoInvalids = [this, simulationsPerTrial, generationWindow](const trial& a, const trial& b)
 			{ return compareResult(a, b, simulationsPerTrial, generationWindow == 0); };
 
 		// Yes, min. compareResult is a reverse
 		decltype(trials)::iterator elite = min_element(trials.begin(), trials.end(), compNoInvalids);
+		endPhase(timings.rank);
 
-		if (maxCacheSize > 0) cache.populateCache(trials);
-
-		int uniquePopulation = 0;
-		int cacheHits = 0;
-		if (gatherStatistics)
-		{
-			set<craft::sequenceType> uniques;
-			for (auto& trial : trials)
-			{
-				uniques.insert(trial.sequence);
-			}
-			uniquePopulation = static_cast<int>(uniques.size());
-			cacheHits = count(cached.begin(), cached.end(), true);
-		}
-
-		if (callback && !callback(generations, gen, simulationsPerTrial, goal, strat, *elite, uniquePopulation, cacheHits))
+		if (callback && !callback(generations, gen, simulationsPerTrial, goal, strat, *elite, uniquePopulation, cacheHits, simsSaved, copySims))
 		{
 			iter_swap(elite, trials.begin());
+			lastRanked = false;
 			break;
 		}
 
@@ -680,34 +1090,28 @@ solver::trial solver::executeSolver(int simulationsPerTrial, int generations, in
 		auto comp = [this, simulationsPerTrial](const trial& a, const trial& b)
 			{ return compareResult(a, b, simulationsPerTrial, false); };
 
+		phaseStart = chrono::steady_clock::now();
 		iter_swap(elite, trials.begin());
 		elite = trials.begin();
 
 		partial_sort(next(trials.begin()), next(trials.begin(), trials.size() / generationRatio) + 1, trials.end(), comp);
+		endPhase(timings.rank);
 
-		vector<trial> selected;
-		selected.reserve(trials.size());
-
-		for (size_t i = 1; i < trials.size(); ++i)	// Start at 1 to make space for elite
-			selected.push_back(trials[d(rng)]);
-
-		mutated.clear();
-		mutated.reserve(selected.size());
-		mutated.push_back(std::move(*elite));	// elite goes across unmodified
-		orders.trials = &selected;
+		// The workers pick the parents as they go. The cache is only read again next generation,
+		// so the main thread fills it in with this one's results before it joins in
+		assert(mutated.size() == trials.size());
+		mutated[0] = *elite;	// elite goes across unmodified
+		orders.trials = &trials;
+		orders.children = &mutated;
 		orders.command = threadCommand::mutate;
-		setOrder(orders);
+		setOrder(orders, [this, cacheState]() { if (cache) cache->populateCache(cacheState, trials); });
 		waitOnMutationsDone();
-		assert(mutated.size() == selected.size() + 1);
+		endPhase(timings.mutate);
 
-		trials = std::move(mutated);
+		swap(trials, mutated);
+		lastRanked = true;
 	}
 
-	orders.command = threadCommand::terminate;
-	setOrder(orders);
-	for (auto& t : threads)
-		t.join();
-
 	if(generationWindow > 0)
 	{
 		// Find a trial that actually starts with the action
@@ -716,113 +1120,130 @@ solver::trial solver::executeSolver(int simulationsPerTrial, int generations, in
 			if (t.sequence.front() == most) return t;
 		// It's theoretically possible for no trial to have the right action. Just let it failover to the best trial
 	}
+	else if (lastRanked && verifyCandidates > 0 && verifySimulations > 0)
+	{
+		phaseStart = chrono::steady_clock::now();
+		verifyBest(orders, mutated, simulationsPerTrial, cacheState);
+		endPhase(timings.simulate);
+	}
 
 	return trials.front();
 }
 
 
-// Called by main thread
-void solver::setOrder(threadOrder odr)
+void addNetResult(solver::netResult& into, const solver::netResult& from, goalType goal)
+{
+	into.successes += from.successes;
+	into.progress += from.progress;
+	into.quality += from.quality;
+	switch (goal)
+	{
+	case goalType::hq:
+		into.hqPercent += from.hqPercent;
+		break;
+	case goalType::maxQuality:
+		break;
+	case goalType::collectability:
+		into.collectableGoalsHit += from.collectableGoalsHit;
+		break;
+	case goalType::points:
+		into.points += from.points;
+		break;
+	}
+	into.invalidActions += from.invalidActions;
+	into.steps += from.steps;
+	if (from.firstInvalid) into.firstInvalid = true;
+	into.simulations += from.simulations;
+}
+
+// Called by main thread, which runs the last share of the order itself before returning.
+// Every share of the order has arrived by the time the main thread sets another
+void solver::setOrder(threadOrder odr, const function<void()>& alongside)
 {
-	unique_lock<std::mutex> lock(orderSetLock);
 	for_each(sequenceCounters.begin(), sequenceCounters.end(),
-		[](atomic<int>& a) {a.store(0, memory_order_relaxed);});
-	threadsDone = 0;
-	activeOrder = odr;
+		[](claimCounter& a) {a.claimed.store(0, memory_order_relaxed);});
+	sharesDone->reset(numberOfThreads);
+	odr.shares = numberOfThreads;
+
+	// Each share works through whatever's left of the order, so it doesn't matter how many of them run at once.
+	// The latch is held by copy: once the last share arrives, the solver might not be there anymore
+	auto perform = [this, odr, latch = sharesDone](int share, randomGenerator& rng)
+		{
+			switch (odr.command)
+			{
+			case threadCommand::simulate:
+				workerPerformSimulations(this, odr, share, rng);
+				break;
+			case threadCommand::mutate:
+				workerPerformMutations(this, odr, share, rng);
+				break;
+			case threadCommand::reduce:
+				reduceSimResults(share);
+				break;
+			case threadCommand::lookup:
+				lookupCached(share, *odr.cache, odr.cacheState, odr.fullSimulations);
+				break;
+			}
+			latch->arrive();
+		};
+	if (numberOfThreads > 1)
+		workerPool::instance().submit(perform, numberOfThreads - 1, priority);
+	if (alongside) alongside();
+	perform(numberOfThreads - 1, mainRng);
+
+	return;
+}
 
-	lock.unlock();
-	orderSet.notify_all();
-	
+void solver::waitOnSharesDone()
+{
+	sharesDone->wait();
 	return;
 }
 
 void solver::waitOnSimsDone()
 {
-	unique_lock<mutex> lock(threadCompleteLock);
+	waitOnSharesDone();
 
-	int* tDone = &threadsDone;
-	int* totalThreads = &numberOfThreads;
-	threadComplete.wait(lock, [&tDone, &totalThreads]() { return *tDone >= *totalThreads;});
-	assert(trials.size() == simResults.size());
-	for (size_t i = 0; i < trials.size(); ++i)
-	{
-		if (cached[i]) continue;
-		trials[i].outcome = simResults[i];
-		memset(&(simResults[i]), 0, sizeof(simResults[i]));
-	}
+	// The slabs are only complete now, so adding them up takes another order
+	threadOrder reduce = {};
+	reduce.command = threadCommand::reduce;
+	setOrder(reduce);
+	waitOnSharesDone();
 
 	return;
 }
 
 void solver::waitOnMutationsDone()
 {
-	unique_lock<mutex> lock(threadCompleteLock);
-	int* tDone = &threadsDone;
-	int* totalThreads = &numberOfThreads;
-	threadComplete.wait(lock, [&tDone, &totalThreads]() {return *tDone >= *totalThreads;});
+	waitOnSharesDone();
 	return;
 }
 
 // Called by worker threads
-solver::threadOrder solver::waitOnCommandChange(threadCommand previous)
+void solver::lookupCached(int share, const resultCache& cache, uint64_t state, int fullSimulations)
 {
-	unique_lock<mutex> lock(orderSetLock);
-
-	threadOrder* odr = &activeOrder;
-	orderSet.wait(lock, [odr, &previous]() { return odr->command != previous; });
-
-	return activeOrder;
+	const size_t first = trials.size() * share / numberOfThreads;
+	const size_t last = trials.size() * (share + 1) / numberOfThreads;
+	for (size_t i = first; i < last; ++i)
+		cached[i] = cache.lookup(state, trials[i].sequence, fullSimulations, trials[i].outcome, trials[i].pooledSimulations);
 }
 
-void solver::reportThreadSimResults(const vector<netResult>& threadResults)
+// Called by worker threads. Adds every slab's results for this share's range of trials into them,
+// so adaptive simulations' several orders a generation keep adding up
+void solver::reduceSimResults(int share)
 {
-	unique_lock<mutex> lock(threadCompleteLock);
-	assert(simResults.size() == threadResults.size());
-
-	for (size_t i = 0; i < trials.size(); ++i)
+	const size_t first = trials.size() * share / numberOfThreads;
+	const size_t last = trials.size() * (share + 1) / numberOfThreads;
+	for (vector<netResult>& slab : resultSlabs)
 	{
-		simResults[i].successes += threadResults[i].successes;
-		simResults[i].progress += threadResults[i].progress;
-		simResults[i].quality += threadResults[i].quality;
-		switch (goal)
+		assert(trials.size() == slab.size());
+		for (size_t i = first; i < last; ++i)
 		{
-		case goalType::hq:
-			simResults[i].hqPercent += threadResults[i].hqPercent;
-			break;
-		case goalType::maxQuality:
-			break;
-		case goalType::collectability:
-			simResults[i].collectableGoalsHit += threadResults[i].collectableGoalsHit;
-			break;
-		case goalType::points:
-			simResults[i].points += threadResults[i].points;
-			break;
+			if (slab[i].simulations == 0) continue;
+			addNetResult(trials[i].outcome, slab[i], goal);
+			memset(&(slab[i]), 0, sizeof(slab[i]));
 		}
-		simResults[i].invalidActions += threadResults[i].invalidActions;
-		simResults[i].steps += threadResults[i].steps;
-		if (threadResults[i].firstInvalid) simResults[i].firstInvalid = true;
 	}
-	threadsDone++;
-	lock.unlock();
-
-	threadComplete.notify_all();	// kick the main thread if it's waiting on threadsDone
-
-	return;
-}
-
-void solver::reportThreadMutationResults(const std::vector<trial>& children)
-{
-	unique_lock<mutex> lock(threadCompleteLock);
-	assert(children.size() <= trials.size());
-
-	mutated.insert(mutated.end(), children.begin(), children.end());
-
-	threadsDone++;
-
-	lock.unlock();
-	threadComplete.notify_all();
-
-	return;
 }
 
 enum class mutationType
@@ -857,75 +1278,76 @@ mutationType getRandomMutation(size_t elements, randomGenerator& rng)
 	else return mutationType::swap;
 }
 
-solver::trial solver::mutateSequence(trial input, randomGenerator& rng)
+// Overwrites child, whose sequence keeps its storage if it has room
+void solver::mutateSequence(const trial& parent, trial& child, randomGenerator& rng)
 {
-	mutationType mutation = getRandomMutation(input.sequence.size(), rng);
+	child = parent;
+
+	mutationType mutation = getRandomMutation(child.sequence.size(), rng);
 
 	switch (mutation)
 	{
 	case mutationType::add:
 	{
-		auto where = input.sequence.begin();
-		bool sequenceHasFirst = !input.sequence.empty() && isFirstAction(input.sequence.front());
-		advance(where, rng.generateInt(sequenceHasFirst ? 1 : 0, static_cast<int>(input.sequence.size())));	// not "- 1"; it can advance to the end iterator
-		actions which = (where == input.sequence.begin()) ?
+		auto where = child.sequence.begin();
+		bool sequenceHasFirst = !child.sequence.empty() && isFirstAction(child.sequence.front());
+		advance(where, rng.generateInt(sequenceHasFirst ? 1 : 0, static_cast<int>(child.sequence.size())));	// not "- 1"; it can advance to the end iterator
+		actions which = (where == child.sequence.begin()) ?
 			availableActions[rng.generateInt(availableActions.size() - 1)] :
 			availableWithoutFirst[rng.generateInt(availableWithoutFirst.size() - 1)];
-		input.sequence.insert(where, which);
-		if (gatherStatistics) input.stats.additions++;
+		child.sequence.insert(where, which);
+		if (gatherStatistics) child.stats.additions++;
 		break;
 	}
 	case mutationType::replace:
 	{
-		assert(!input.sequence.empty());
-		auto where = input.sequence.begin();
-		advance(where, rng.generateInt(input.sequence.size() - 1));
-		actions which = (where == input.sequence.begin()) ?
+		assert(!child.sequence.empty());
+		auto where = child.sequence.begin();
+		advance(where, rng.generateInt(child.sequence.size() - 1));
+		actions which = (where == child.sequence.begin()) ?
 			availableActions[rng.generateInt(availableActions.size() - 1)] :
 			availableWithoutFirst[rng.generateInt(availableWithoutFirst.size() - 1)];
 		*where = which;
-		if (gatherStatistics) input.stats.replacements++;
+		if (gatherStatistics) child.stats.replacements++;
 		break;
 	}
 	case mutationType::remove:
 	{
-		assert(!input.sequence.empty());
-		auto where = input.sequence.begin();
-		advance(where, rng.generateInt(input.sequence.size() - 1));
-		input.sequence.erase(where);
-		if (gatherStatistics) input.stats.removals++;
+		assert(!child.sequence.empty());
+		auto where = child.sequence.begin();
+		advance(where, rng.generateInt(child.sequence.size() - 1));
+		child.sequence.erase(where);
+		if (gatherStatistics) child.stats.removals++;
 		break;
 	}
 	case mutationType::shift:
 	{
-		assert(input.sequence.size() > 1);
-		auto low = input.sequence.begin();
-		auto high = input.sequence.begin();
-		advance(low, rng.generateInt(isFirstAction(*low) ? 1 : 0, static_cast<int>(input.sequence.size() - 1)));
-		advance(high, rng.generateInt(isFirstAction(*high) ? 1 : 0, static_cast<int>(input.sequence.size() - 1)));
+		assert(child.sequence.size() > 1);
+		auto low = child.sequence.begin();
+		auto high = child.sequence.begin();
+		advance(low, rng.generateInt(isFirstAction(*low) ? 1 : 0, static_cast<int>(child.sequence.size() - 1)));
+		advance(high, rng.generateInt(isFirstAction(*high) ? 1 : 0, static_cast<int>(child.sequence.size() - 1)));
 		if (high < low) swap(low, high);
 
 		// To grab the first and put it on the end, move first+1 to first
 		// To grab the last and put it at the beginning, move last to first
 		decltype(low) grabbed = rng.generateInt(1) == 0 ? low + 1 : high;
 		rotate(low, grabbed, high + 1);
-		if (gatherStatistics) input.stats.shifts++;
+		if (gatherStatistics) child.stats.shifts++;
 		break;
 	}
 	case mutationType::swap:
 	{
-		assert(input.sequence.size() > 1);
-		auto first = input.sequence.begin();
-		auto second = input.sequence.begin();
-		advance(first, rng.generateInt(isFirstAction(*first) ? 1 : 0, static_cast<int>(input.sequence.size() - 1)));
-		advance(second, rng.generateInt(isFirstAction(*second) ? 1 : 0, static_cast<int>(input.sequence.size() - 1)));
+		assert(child.sequence.size() > 1);
+		auto first = child.sequence.begin();
+		auto second = child.sequence.begin();
+		advance(first, rng.generateInt(isFirstAction(*first) ? 1 : 0, static_cast<int>(child.sequence.size() - 1)));
+		advance(second, rng.generateInt(isFirstAction(*second) ? 1 : 0, static_cast<int>(child.sequence.size() - 1)));
 		iter_swap(first, second);
-		if (gatherStatistics) input.stats.swaps++;
+		if (gatherStatistics) child.stats.swaps++;
 		break;
 	}
 	}
-
-	return input;
 }
 
 
@@ -933,103 +1355,207 @@ solver::trial solver::mutateSequence(trial input, randomGenerator& rng)
 THREAD FUNCTIONS
 */
 
-void workerPerformSimulations(solver* solve, solver::threadOrder order, randomGenerator& rng)
+// Where sims of the sequence can start. known is reused if it's within the first unchanged actions of the sequence
+craft::snapshot startingPoint(const craft& initialState, const craft::sequenceType& sequence, const craft::snapshot& known, size_t unchanged)
 {
-	size_t trialNumber = 0;
+	const bool usable = known.position > 0 && static_cast<size_t>(known.position) <= unchanged;
+	return initialState.advanceSnapshot(sequence, usable ? known : initialState.startSnapshot());
+}
 
-	vector<solver::netResult> localResults;
+// Adds times sims that all came out as result
+void addResult(solver::netResult& net, const craft::endResult& result, int times, const solver::threadOrder& order)
+{
+	net.progress += result.progress * times;
+	if (result.progress >= order.recipe->difficulty)	// a failed synth is always worth 0 quality, even in hqorbust mode
+	{
+		net.successes += times;
+		net.quality += result.quality * times;
+		switch (order.goal)
+		{
+		case goalType::hq:
+			net.hqPercent += result.hqPercent * times;
+			break;
+		case goalType::maxQuality:
+			break;
+		case goalType::collectability:
+			if (result.collectableHit) net.collectableGoalsHit += times;
+			break;
+		case goalType::points:
+			net.points += result.points * times;
+			break;
+		}
+	}
+	net.steps += result.steps * times;
+	net.invalidActions += result.invalidActions * times;
+	if (result.firstInvalid) net.firstInvalid = true;
+	net.simulations += times;
+}
 
-	localResults.resize(order.trials->size(), solver::netResult{});
+// Adds an exact evaluation as times sims' worth, so compareResult can't tell it from sims
+void addExpected(solver::netResult& net, const exactEvaluator::expectedResult& expected, int times, const solver::threadOrder& order)
+{
+	auto scaled = [times](double value) { return static_cast<int>(lround(value * times)); };
+	net.successes += scaled(expected.successes);
+	net.progress += scaled(expected.progress);
+	net.quality += scaled(expected.quality);
+	switch (order.goal)
+	{
+	case goalType::hq:
+		net.hqPercent += scaled(expected.hqPercent);
+		break;
+	case goalType::maxQuality:
+		break;
+	case goalType::collectability:
+		net.collectableGoalsHit += scaled(expected.collectableGoalsHit);
+		break;
+	case goalType::points:
+		net.points += scaled(expected.points);
+		break;
+	}
+	net.steps += scaled(expected.steps);
+	net.invalidActions += scaled(expected.invalidActions);
+	if (expected.firstInvalid) net.firstInvalid = true;
+	net.simulations += times;
+}
 
-	while (trialNumber < order.trials->size())
+void workerPerformSimulations(solver* solve, solver::threadOrder order, int share, randomGenerator& rng)
+{
+	const size_t trialCount = order.trials->size();
+
+	// Nobody else touches this share's slab until the reduce
+	vector<solver::netResult>& localResults = solve->resultSlab(share);
+
+	batchSimulator batch(*order.initialState);
+	exactEvaluator exact(*order.initialState);
+	craft::endResult results[maxBatchLanes];
+	double weights[maxBatchLanes];
+	size_t batchTrial = trialCount;
+	craft::snapshot start{};
+
+	// Sims are claimed in whole batches, enough of them that the order comes to about chunksPerShare claims per worker.
+	// Only the trials in the order count, so a multi's one trial or a verification's few get split up, and a generation's
+	// trials mostly go whole
+	const size_t ordered = count(order.cached->begin(), order.cached->end(), 0);
+	const size_t perChunk = ordered * order.numberOfSimulations / (order.shares * chunksPerShare);
+	const int chunkSize = min(order.numberOfSimulations,
+		max(1, static_cast<int>((perChunk + batch.width() - 1) / batch.width())) * batch.width());
+
+	// Each worker starts at its own place in the trials, so they only meet on a counter once they've finished their own stretch
+	const size_t first = trialCount * share / order.shares;
+	size_t visited = 0;
+	while (visited < trialCount)
 	{
-		if (
-			// Is this result in the cache?
-			(*order.cached)[trialNumber]
-			||
-			// Have we (and the other threads) done all the sims for this one?
-			(*order.counters)[trialNumber].fetch_add(1, memory_order_relaxed) >= order.numberOfSimulations
-			)
+		const size_t trialNumber = (first + visited) % trialCount;
+
+		// Is this result in the cache?
+		// Or have we (and the other threads) done all the sims for this one already?
+		if ((*order.cached)[trialNumber] ||
+			(*order.counters)[trialNumber].claimed.load(memory_order_relaxed) >= order.numberOfSimulations)
 		{
-			trialNumber++;
+			visited++;
 			continue;
 		}
-		craft synth(*order.initialState);
-		synth.setRNG(&rng);
 
-		craft::endResult result = synth.performAll((*order.trials)[trialNumber].sequence, order.goal, false);
-		localResults[trialNumber].progress += result.progress;
-		if (result.progress >= order.recipe->difficulty)	// a failed synth is always worth 0 quality, even in hqorbust mode
+		const solver::trial& current = (*order.trials)[trialNumber];
+		if (batchTrial != trialNumber)
 		{
-			localResults[trialNumber].successes++;
-			localResults[trialNumber].quality += result.quality;
-			switch (order.goal)
+			start = startingPoint(*order.initialState, current.sequence, current.prefix, current.sequence.size());
+			if (!start.decided) batch.setSequence(current.sequence, start);
+			batchTrial = trialNumber;
+		}
+
+		// A decided trial comes out the same every time, and an exact evaluation covers every sim,
+		// so whoever gets to either takes all the sims left, in this order and the rest of the generation.
+		// Exact evaluation is only tried before a trial has any sims, so once it's given up the sims go in chunks
+		const bool tryExact = order.exactEvaluation && current.outcome.simulations == 0;
+		const int claimSize = start.decided || tryExact ? order.numberOfSimulations : chunkSize;
+		const int claimed = (*order.counters)[trialNumber].claimed.fetch_add(claimSize, memory_order_relaxed);
+		if (claimed >= order.numberOfSimulations)
+		{
+			visited++;
+			continue;
+		}
+		const int count = min(claimSize, order.numberOfSimulations - claimed);
+		const int remaining = order.fullSimulations - current.outcome.simulations;
+
+		// Importance sampling only looks at the first trial. Results that don't depend on luck are worth what they are,
+		// and each sim's is weighted by how much likelier its rolls were made
+		double* const weightedFailures = trialNumber == 0 ? order.weightedFailures : nullptr;
+		exactEvaluator::expectedResult expected;
+		if (start.decided)
+		{
+			craft synth(*order.initialState);
+			synth.setRNG(&rng);
+			const craft::endResult result = synth.performFrom(current.sequence, start, order.goal);
+			addResult(localResults[trialNumber], result, remaining, order);
+			if (weightedFailures != nullptr)
+				fill_n(weightedFailures + current.outcome.simulations, remaining, result.progress < order.recipe->difficulty ? 1.0 : 0.0);
+		}
+		// Give up on it once it's followed as many actions as the sims it replaces would have performed (or with
+		// exactOnly, the order's sims). If it gave up in an earlier round of this generation, it'll give up again
+		else if (tryExact && exact.evaluate(current.sequence, start, order.goal,
+			static_cast<size_t>(order.exactOnly ? order.numberOfSimulations : remaining) * (current.sequence.size() - start.position), expected))
+		{
+			addExpected(localResults[trialNumber], expected, remaining, order);
+			if (weightedFailures != nullptr)
+				fill_n(weightedFailures, remaining, 1.0 - expected.successes);
+		}
+		else if (!order.exactOnly)
+		{
+			const int firstSim = current.outcome.simulations + claimed;
+			for (int done = 0; done < count; done += batch.width())
 			{
-			case goalType::hq:
-				localResults[trialNumber].hqPercent += result.hqPercent;
-				break;
-			case goalType::maxQuality:
-				break;
-			case goalType::collectability:
-				if (result.collectableHit) localResults[trialNumber].collectableGoalsHit++;
-				break;
-			case goalType::points:
-				localResults[trialNumber].points += result.points;
-				break;
+				const int batchCount = min(batch.width(), count - done);
+				if (order.luck != nullptr) batch.simulate(batchCount, order.goal, *order.luck, firstSim + done, results, weights);
+				else batch.simulate(batchCount, order.goal, rng, results);
+				for (int i = 0; i < batchCount; ++i)
+				{
+					addResult(localResults[trialNumber], results[i], 1, order);
+					if (weightedFailures != nullptr && results[i].progress < order.recipe->difficulty)
+						weightedFailures[firstSim + done + i] = weights[i];
+				}
 			}
 		}
-		localResults[trialNumber].steps += result.steps;
-		localResults[trialNumber].invalidActions += result.invalidActions;
-		if (result.firstInvalid) localResults[trialNumber].firstInvalid = true;
 	}
 
-	// Everything's done (or has been claimed by another thread), so time to report in and wait for the next order
-	solve->reportThreadSimResults(localResults);
-
+	// Everything's done (or has been claimed by another thread)
 	return;
 }
 
-void workerPerformMutations(solver* solve, solver::threadOrder order, randomGenerator& rng)
+void workerPerformMutations(solver* solve, solver::threadOrder order, int share, randomGenerator& rng)
 {
-	vector<solver::trial> localMutated;
-	for (size_t trialNumber = 0; trialNumber < order.trials->size(); trialNumber++)
+	// Children are handed out a run at a time. The runs are split into a stretch for each worker, which claims them in order
+	// through the counter of its stretch's first child, then helps with the others' stretches once its own is done
+	const size_t childCount = order.children->size() - 1;
+	const size_t chunkSize = max<size_t>(1, childCount / (order.shares * chunksPerShare));
+	const size_t chunks = (childCount + chunkSize - 1) / chunkSize;
+	const size_t stretches = min(static_cast<size_t>(order.shares), chunks);
+
+	for (size_t visited = 0; visited < stretches; visited++)
 	{
-		if ((*order.counters)[trialNumber].fetch_add(1, memory_order_relaxed) > 0)
+		const size_t stretch = (share + visited) % stretches;
+		const size_t firstChunk = chunks * stretch / stretches;
+		const size_t stretchChunks = chunks * (stretch + 1) / stretches - firstChunk;
+		atomic<int>& counter = (*order.counters)[firstChunk * chunkSize].claimed;
+		while (counter.load(memory_order_relaxed) < static_cast<int>(stretchChunks))
 		{
-			// This one's been claimed by another thread
-			continue;
+			const size_t claimed = static_cast<size_t>(counter.fetch_add(1, memory_order_relaxed));
+			// Someone else got the last of it
+			if (claimed >= stretchChunks) break;
+
+			const size_t begin = (firstChunk + claimed) * chunkSize;
+			const size_t end = min(begin + chunkSize, childCount);
+			for (size_t childNumber = begin; childNumber < end; childNumber++)
+			{
+				const solver::trial& parentTrial = (*order.trials)[solve->selectParent(rng)];
+				solver::trial& child = (*order.children)[childNumber + 1];	// after the elite
+				solve->mutateSequence(parentTrial, child, rng);
+				const size_t unchanged = static_cast<size_t>(mismatch(parentTrial.sequence.begin(), parentTrial.sequence.end(),
+					child.sequence.begin(), child.sequence.end()).first - parentTrial.sequence.begin());
+				child.prefix = startingPoint(*order.initialState, child.sequence, parentTrial.prefix, unchanged);
+			}
 		}
-		const solver::trial& parentTrial = (*order.trials)[trialNumber];
-		localMutated.push_back(solve->mutateSequence(parentTrial, rng));
 	}
 
-	solve->reportThreadMutationResults(localMutated);
-
 	return;
 }
-
-void workerMain(solver* solve)
-{
-#if defined _WIN32
-	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
-#endif // defined _WIN32
-
-	randomGenerator rng;
-	solver::threadOrder order;
-	order.command = solver::threadCommand::terminate;
-	while (true)
-	{
-		order = solve->waitOnCommandChange(order.command);
-		switch (order.command)
-		{
-		case solver::threadCommand::simulate:
-			workerPerformSimulations(solve, order, rng);
-			continue;
-		case solver::threadCommand::mutate:
-			workerPerformMutations(solve, order, rng);
-			continue;
-		case solver::threadCommand::terminate:
-			return;
-		}
-	}
-}
\ No newline at end of file
@@ -1,11 +1,16 @@
 #pragma once
 #include <vector>
+#include <string>
 #include <map>
 #include <thread>
 #include <atomic>
+#include <memory>
 #include <functional>
 #include "common.h"
 #include "craft.h"
+#include "pool.h"
+
+class resultCache;
 
 class solver
 {
@@ -14,7 +19,8 @@ public:
 	{
 		simulate,
 		mutate,
-		terminate
+		reduce,	// add up the sim slabs into the trials
+		lookup	// fill in the trials already in the cache
 	};
 
 	struct netResult
@@ -29,19 +35,46 @@ public:
 			int collectableGoalsHit;	// an individual run would only add 0 or 1 to this
 			int points;
 		};
-		short steps;		// actions until the synth ends, not neccesarily the size of the sequence
-		short invalidActions;		// i.e. those that don't occur due to preconditions not met, insufficient CP, or occuring after the end of the synth
+		int steps;		// actions until the synth ends, not neccesarily the size of the sequence
+		int invalidActions;		// i.e. those that don't occur due to preconditions not met, insufficient CP, or occuring after the end of the synth
 		bool firstInvalid;		// doesn't need to be a sum. if it's true for any of them it's true for all of them
+		int simulations;	// how many runs the sums are over
+	};
+
+	// How far off each of a multisim's averages could be, from how much independent replicates of it disagree
+	struct standardErrors
+	{
+		double successes;	// of the success rate, from 0 to 1
+		double goal;		// of the average HQ%, quality, collectable goal rate (0 to 1) or points
+	};
+
+	// An unbiased failure rate from importance sampling. The multisim's other results come from sims pushed toward
+	// failing, so in that mode only this means anything
+	struct failureEstimate
+	{
+		double rate;	// from 0 to 1
+		double standardError;
 	};
 
 	struct trial
 	{
 		craft::sequenceType sequence;
 		/*
-		outcome is not atomic. each thread will hold a vector<netResult> for the results of each trial
-		(with full 0 for any not performed), and combine them under lock
+		outcome is not atomic. each share of a sim order adds into its own slab of netResults, one for each trial
+		(left 0 for any not performed), and a reduce order adds the slabs up a range of trials per share
 		*/
 		netResult outcome{};
+		// outcome came from all its sims being run this generation, not the cache, an earlier copy or scaling up
+		// after adaptive simulations retired it. Only these go in the cache
+		bool simulated = false;
+		// how many sims outcome is the average of. outcome's always scaled to a generation's worth, but survivors
+		// (see pickSurvivors) can have had more
+		int pooledSimulations = 0;
+		/*
+		as far into the sequence as every sim agrees (see craft::advanceSnapshot), so sims can start from there.
+		position 0 means it's not known yet. children inherit it when the mutation leaves that much of the sequence alone
+		*/
+		craft::snapshot prefix{};
 
 		struct statistics
 		{
@@ -62,42 +95,117 @@ public:
 		statistics stats;
 	};
 
+	// One of the best few sequences a solve ended with, simulated again with more sims (see setVerification)
+	struct verifiedCandidate
+	{
+		trial candidate;	// outcome is over the verification's sims, not the generation's
+		standardErrors errors;
+	};
+
+	// Padded out to a cache line each, so threads claiming work from neighbouring trials don't fight over the line
+	struct claimCounter
+	{
+		std::atomic<int> claimed;
+		char padding[64 - sizeof(std::atomic<int>)];
+	};
+
 	struct threadOrder
 	{
 		threadCommand command;
+		int shares;	// how many workers the order is split between. set by setOrder
 		std::vector<trial> const * trials;
-		std::vector<std::atomic<int>>* counters;
-		std::vector<bool> const * cached;
+		std::vector<claimCounter>* counters;
+		std::vector<char> const * cached;
 		// used in sim mode
 		crafterStats const * crafter;
 		recipeStats const * recipe;
 		craft const * initialState;
-		int numberOfSimulations;
+		int numberOfSimulations;	// to run on each trial in this order
+		int fullSimulations;		// the most any trial gets in a generation. decided and exactly evaluated trials go straight to this
 		goalType goal;
+		bool exactEvaluation;
+		luckTapes const * luck;	// if set, sim j of every trial replays tape j
+		double* weightedFailures;	// if set, sim j writes its weighted failure here, 0 if it succeeded. trials[0] only
+		bool exactOnly;		// only evaluate exactly, giving up past numberOfSimulations sims' work and leaving those trials alone
+		// used in mutate mode: children[1] onward get a child each, of parents picked from trials by selection.
+		// children[0] is the elite
+		std::vector<trial>* children;
+		// used in lookup mode
+		resultCache const * cache;
+		uint64_t cacheState;	// what the cache knows this generation's results by, besides their sequences
 	};
 
-private:
-	threadOrder activeOrder;	// not atomic: protected with orderSetLock
+	// How long the main thread spent in each part of executeSolver's generations, in seconds
+	struct phaseTimes
+	{
+		double lookup;		// finding trials in the cache, and copies of each other alongside
+		double simulate;	// including adding up the results and handing them to the copies
+		double rank;		// picking the elite and sorting the best to the front. the only part that's the main thread's alone
+		double mutate;		// including selection, and filling the cache alongside
+	};
 
+private:
 	const crafterStats crafter;
 	const recipeStats recipe;
 	goalType goal;
+	const craft::context context;	// every craft the solver simulates points at this, so it must be declared before initialState
 	craft initialState;
-	int numberOfThreads;
+	int numberOfThreads;	// how many shares of each order go to the worker pool
+	int priority;	// the pool's weight for this solver's orders against other solvers'
 	
 	strategy strat;
 
 	bool gatherStatistics;
 
+	// Evaluate trials with exactEvaluator where it can, scaled up to look like numberOfSimulations sims
+	bool exactEvaluation;
+
+	// Give trials their sims in rounds, retiring those clearly behind the last generation's elite
+	bool adaptiveSimulations;
+
+	// Draw luck tapes for each generation so every trial is simmed under the same luck
+	bool commonRandomNumbers;
+	luckTapes luck;
+	randomGenerator luckSource;
+
+	// How executeMultisim draws its sims' luck, and the standard errors it last came up with
+	samplingMethod sampling;
+	standardErrors multisimErrors;
+	failureEstimate multisimFailures;
+
+	// How many of executeSolver's best sequences it simulates again at the end, and with how many sims. 0 skips it
+	int verifyCandidates;
+	int verifySimulations;
+	std::vector<verifiedCandidate> verified;
+
+	int tapeLength() const;
+	// Runs the sims in independent blocks, giving the standard errors of each of the first count trials from how much they disagree
+	std::vector<standardErrors> runReplicates(threadOrder& orders, int simulationsPerTrial, size_t count);
+	void estimateFailures(threadOrder& orders, int simulationsPerTrial);
+
 	// Expected offspring of fittest individual
 	double offspringOfFittest;
 	
-	std::vector<trial> trials;	// protected by threadCompleteLock, newest to oldest
-	std::vector<netResult> simResults;
-	std::vector<bool> cached;
-	// mutated is cleared at the start of each run, then appended to by the thread reporters under lock
+	std::vector<trial> trials;	// newest to oldest
+	std::vector<std::vector<netResult>> resultSlabs;	// one for each share of a sim order, zeroed again by the reduce
+	// Kept between executeSolver calls, so a solve from a state that's come up before starts out knowing what the last
+	// one found out. Made again if the size asked for changes, unless it's in a file
+	std::unique_ptr<resultCache> cache;
+	int cacheSize;
+	bool cacheInFile;	// then it's kept whatever size executeSolver asks for
+	std::vector<char> cached;	// not vector<bool>: the lookup's shares each write their own range of it
+	// cached is 1 for trials found in the cache, and this for trials with the same sequence as an earlier one this
+	// generation. Those aren't simulated, and take the earlier one's result once it has one
+	static constexpr char copyOfEarlier = 2;
+	std::vector<int> originals;	// for each trial, the first one this generation with the same sequence. itself if there isn't one
+	std::vector<int> firstCopies;	// open addressing table of trial indices, -1 if empty. findCopies' scratch space
+	// for each trial getting more sims as a survivor this generation, what it had before. earlierSimulations is 0 for the rest
+	std::vector<netResult> earlierResults;
+	std::vector<int> earlierSimulations;
+	// the next generation, written a child at a time into its place by whichever share made it, then swapped with trials.
+	// the two keep their sequences' storage between generations
 	std::vector<trial> mutated;
-	std::vector<std::atomic<int>> sequenceCounters;	// kept separate: trials must be movable for sort to work
+	std::vector<claimCounter> sequenceCounters;	// kept separate: trials must be movable for sort to work
 
 #if ATOMIC_INT_LOCK_FREE != 2
 #warning "atomic<int> is not always lock free on this platform. consider changing the type of sequenceCounters"
@@ -106,16 +214,28 @@ private:
 	const std::vector<actions> availableActions, availableWithoutFirst;	// used in solve mode. cached here
 																		// accessed by multiple threads read-only
 
-	std::condition_variable orderSet, threadComplete;
-	std::mutex orderSetLock, threadCompleteLock;
-	
-	int threadsDone;	// not atomic: protected with threadCompleteLock. reset in setOrder
+	// The pool runs all but the last share of each order, which the main thread runs itself. Shared with the
+	// pool's copies of the order, so the last share can still finish arriving if the solver's gone by then
+	std::shared_ptr<shareLatch> sharesDone;
+	randomGenerator mainRng;	// for the main thread's shares
+
+	void waitOnSharesDone();
 
 	bool compareResult(const solver::trial& a, const solver::trial& b, int simulationsPerTrial, bool alwaysRejectInvalids) const;
+	bool clearlyWorse(const netResult& result, const netResult& elite) const;
+
+	// Runs the generation's sims. Returns how many sims adaptive simulations saved
+	int simulateGeneration(threadOrder& orders, int simulationsPerTrial, const netResult& elite);
+	int findCopies();
+	void pickSurvivors(int simulationsPerTrial, const netResult& lastElite, bool coalesceCopies);
+	void poolSurvivors(uint64_t cacheState);
+	void verifyBest(threadOrder& orders, const std::vector<trial>& ranked, int simulationsPerTrial, uint64_t cacheState);
 
-	std::vector<double> populationSelections;
+	std::vector<double> populationSelections;	// cumulative, so a uniform draw can be looked up in it
+	phaseTimes timings;
 
 	void setSelections(int population);
+	void reserveGenerations();
 
 public:
 	static std::vector<actions> getAvailable(const crafterStats& crafter, const recipeStats& recipe, bool useConditionals, bool includeFirst);
@@ -123,6 +243,7 @@ public:
 	static int actionLevel(actions action);
 
 	solver() = delete;
+	~solver();
 
 	// Constructor for multisynth mode
 	solver(const crafterStats& c, const recipeStats & r, const craft::sequenceType& seed,
@@ -155,7 +276,74 @@ public:
 		double selectionPressure
 	);
 
-	void setInitialState(craft iS) { initialState = iS; }
+	void setInitialState(const craft& iS)
+	{
+		initialState = iS;
+		initialState.setContext(context);
+		for (auto& t : trials)
+			t.prefix = {};
+	}
+
+	void setExactEvaluation(bool e)
+	{
+		exactEvaluation = e;
+	}
+
+	void setAdaptiveSimulations(bool a)
+	{
+		adaptiveSimulations = a;
+	}
+
+	void setCommonRandomNumbers(bool c)
+	{
+		commonRandomNumbers = c;
+	}
+
+	void setSampling(samplingMethod s)
+	{
+		sampling = s;
+	}
+
+	// Keeps the cache in the file at path from now on, so it carries over to other runs and is shared with any other
+	// process using the same file. maxCacheSize is then ignored, and the file keeps the size it was made with.
+	// False, leaving the cache as it was, if the file can't be used
+	bool setCacheFile(const std::string& path, int maxSize);
+
+	// At the end of executeSolver, simulates the last generation's best candidates different sequences again with
+	// simulations sims each, and returns whichever comes out best on those instead of on the generation's sims.
+	// Off (0 candidates) by default. A solve stopped by its callback, or picking by generationWindow, skips it
+	void setVerification(int candidates, int simulations)
+	{
+		verifyCandidates = candidates;
+		verifySimulations = simulations;
+	}
+
+	// 1 by default. Only matters against other solvers running at the same time
+	void setPriority(int p)
+	{
+		priority = p;
+	}
+
+	const standardErrors& getStandardErrors() const
+	{
+		return multisimErrors;
+	}
+
+	const failureEstimate& getFailureEstimate() const
+	{
+		return multisimFailures;
+	}
+
+	// What the last executeSolver's verification found, best first. Empty if it didn't run
+	const std::vector<verifiedCandidate>& getVerified() const
+	{
+		return verified;
+	}
+
+	const phaseTimes& getPhaseTimes() const
+	{
+		return timings;
+	}
 
 	void resetSeeds(const craft::sequenceType& seed);
 
@@ -172,7 +360,9 @@ public:
 			strategy strat,
 			trial outcome,
 			int uniquePopulation,	// 0 if gatherStatistics == false
-			int cacheHits			// 0 if gatherStatistics == false
+			int cacheHits,			// 0 if gatherStatistics == false
+			int simsSaved,			// by adaptive simulations this generation
+			int copySims			// not run on copies of an earlier trial, under common random numbers. 0 if gatherStatistics == false
 			)>;
 
 	trial executeSolver(
@@ -191,13 +381,17 @@ public:
 	
 	/* interthread communication */
 	// called by main thread
-	void setOrder(threadOrder odr);
+	void setOrder(threadOrder odr, const std::function<void()>& alongside = nullptr);	// alongside runs on the main thread first
 	void waitOnSimsDone();
 	void waitOnMutationsDone();
 
 	// called by the worker threads
-	threadOrder waitOnCommandChange(threadCommand previous);
-	void reportThreadSimResults(const std::vector<netResult>& threadResults);	// after calling this, thread returns to waiting on command
-	void reportThreadMutationResults(const std::vector<trial>& children);
-	trial mutateSequence(trial input, randomGenerator& rng);
+	std::vector<netResult>& resultSlab(int share)
+	{
+		return resultSlabs[share];
+	}
+	void reduceSimResults(int share);
+	void lookupCached(int share, const resultCache& cache, uint64_t state, int fullSimulations);
+	size_t selectParent(randomGenerator& rng) const;
+	void mutateSequence(const trial& parent, trial& child, randomGenerator& rng);
 };
\ No newline at end of file
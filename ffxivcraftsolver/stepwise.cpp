@@ -5,6 +5,7 @@
 
 #include <cassert>
 #include <csignal>
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include <stack>
@@ -212,10 +213,12 @@ bool setCondition(const vector<string>& command, const recipeStats recipe, craft
 	return true;
 }
 
-bool stepwiseUpdate(int generations, int currentGeneration, int simsPerTrial, goalType goal, strategy strat, solver::trial status, int uniquePopulation, int cacheHits)
+bool stepwiseUpdate(int generations, int currentGeneration, int simsPerTrial, goalType goal, strategy strat, solver::trial status, int uniquePopulation, int cacheHits, int simsSaved, int copySims)
 {
 	(void)uniquePopulation;
 	(void)cacheHits;
+	(void)simsSaved;
+	(void)copySims;
 	if (termFlag) return false;
 
 	const chrono::milliseconds updateDelay(500ms);
@@ -324,17 +327,24 @@ int performStepwise(
 	int stepwiseGenerations,
 	int population,
 	int maxCacheSize,
+	const string& cacheFile,
 	strategy strat,
 	double selectionPressure
 	)
 {
 	randomGenerator rand;
+	const craft::context craftContext(crafter, recipe, false);
 	stack<craft> craftHistory;
-	craftHistory.emplace(initialQuality, crafter, recipe, false);
+	craftHistory.emplace(initialQuality, craftContext);
 	
 	craftHistory.top().setRNG(&rand);
 
 	solver solve(crafter, recipe, seed, goal, craftHistory.top(), threads, strat, population, selectionPressure);
+	if (!cacheFile.empty() && !solve.setCacheFile(cacheFile, maxCacheSize))
+	{
+		cerr << "failed to open cache file " << cacheFile << endl;
+		exit(1);
+	}
 	int lastSolvedStep = 0;
 
 	bool printStatus = true;		// Generally doubles as a success/fail flag
@@ -632,19 +642,30 @@ int performAutoStepwise(
 	int stepwiseGenerations,
 	int population,
 	int maxCacheSize,
+	const string& cacheFile,
 	strategy strat,
 	double selectionPressure
 )
 {
 	randomGenerator rand;
 
-	craft startingCraft(initialQuality, crafter, recipe, false);
+	const craft::context craftContext(crafter, recipe, false);
+	craft startingCraft(initialQuality, craftContext);
+	startingCraft.setRNG(&rand);
 
+	// One solver for every craft, so its cache carries over. Each craft starts from the same state,
+	// and goes through the same ones for as long as it takes the same actions
+	solver solve(crafter, recipe, seed, goal, startingCraft, threads, strat, population, selectionPressure);
+	if (!cacheFile.empty() && !solve.setCacheFile(cacheFile, maxCacheSize))
+	{
+		cerr << "failed to open cache file " << cacheFile << endl;
+		exit(1);
+	}
 	while (true)
 	{
 		craft currentCraft(startingCraft);
-		currentCraft.setRNG(&rand);
-		solver solve(crafter, recipe, seed, goal, currentCraft, threads, strat, population, selectionPressure);
+		solve.setInitialState(currentCraft);
+		solve.resetSeeds(seed);
 		while (!currentCraft.maxedProgress() && !currentCraft.outOfDurability())
 		{
 			craft::sequenceType result = solve.executeSolver(simsPerSequence, stepwiseGenerations * generationMultiplier, stepwiseGenerations, stepwiseGenerations * streakTolerance / 100, maxCacheSize, nullptr).sequence;
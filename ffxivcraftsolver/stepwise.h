@@ -14,6 +14,7 @@ int performStepwise(
 	int stepwiseGenerations,
 	int population,
 	int maxCacheSize,
+	const std::string& cacheFile,
 	strategy strat,
 	double selectionPressure
 );
@@ -29,6 +30,7 @@ int performAutoStepwise(
 	int stepwiseGenerations,
 	int population,
 	int maxCacheSize,
+	const std::string& cacheFile,
 	strategy strat,
 	double selectionPressure
 );
\ No newline at end of file